@@ -1,3 +1,7 @@
+// off_t is 64 bits even on 32 bit systems, so files past 4 GB work everywhere
+#define _FILE_OFFSET_BITS 64
+// for pthread_rwlockattr_setkind_np(), see page_latch()
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,6 +12,26 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define HAVE_IO_URING
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
 // Create an InputBuffer object to handle tokenization of user input
 typedef struct {
@@ -20,12 +44,14 @@ typedef struct {
 typedef enum {
     EXECUTE_TABLE_FULL,
     EXECUTE_DUPLICATE_KEY,
+    EXECUTE_KEY_NOT_FOUND,
     EXECUTE_SUCCESS
 } ExecuteResult;
 
 // define return values for processing meta commands, to be used by do_meta_command()
 typedef enum {
     META_COMMAND_SUCCESS,
+    META_COMMAND_EXIT,
     META_COMMAND_UNRECOGNIZED_COMMAND
 } MetaCommandResult;
 
@@ -35,14 +61,35 @@ typedef enum {
     PREPARE_NEGATIVE_ID,
     PREPARE_SYNTAX_ERROR,
     PREPARE_UNRECOGNIZED_STATEMENT,
-    PREPARE_STRING_TOO_LONG
+    PREPARE_STRING_TOO_LONG,
+    PREPARE_NO_SUCH_STATEMENT
 } PrepareResult;
 
+// define return values for bulk loading a file, to be used by table_bulk_load()
+typedef enum {
+    LOAD_SUCCESS,
+    LOAD_TABLE_NOT_EMPTY,
+    LOAD_CANT_OPEN_FILE,
+    LOAD_INVALID_ROW,
+    LOAD_DUPLICATE_KEY
+} LoadResult;
+
 typedef enum {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_DELETE,
+    STATEMENT_UPDATE,
+    STATEMENT_CREATE_INDEX
 } StatementType;
 
+// the columns a secondary index can be created on
+typedef enum {
+    INDEX_USERNAME,
+    INDEX_EMAIL
+} IndexColumn;
+
+#define NUM_INDEX_COLUMNS 2
+
 // establishes how much space to be allocated for usernames and emails
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
@@ -53,15 +100,69 @@ typedef struct {
     char email[COLUMN_EMAIL_SIZE + 1];
 } Row;
 
+// select without a where clause covers every id, and without limit every row
+#define NO_LIMIT UINT32_MAX
+
+// select count(*), min(id), max(id), sum(id), in any combination, instead of rows
+typedef enum {
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_SUM
+} AggregateType;
+
+#define MAX_AGGREGATES 8
+
+// where the value bound to a ? in a prepared statement goes
+typedef enum {
+    PARAM_ROW_ID,
+    PARAM_ROW_USERNAME,
+    PARAM_ROW_EMAIL,
+    PARAM_KEY,              // where id = ?, which is both ends of the range
+    PARAM_MIN_ID,
+    PARAM_MAX_ID,
+    PARAM_LIMIT,
+    PARAM_OFFSET,
+    PARAM_WHERE_VALUE       // where username = ?, or like ?
+} ParamTarget;
+
+typedef struct {
+    ParamTarget target;
+    u_int32_t row;          // which row of an insert the column belongs to
+} Param;
+
 typedef struct {
     StatementType type;
-    Row row_to_insert;
+    Row* rows;              // an insert can carry any number of rows
+    u_int32_t num_rows;
+    u_int32_t rows_capacity;
+    Row row_to_insert;      // update keeps the id and the new column values here
+    bool set_username;      // which columns an update changes
+    bool set_email;
+    // select returns the rows with min_id <= id <= max_id, at most limit of them after skipping the first offset.
+    // delete removes that same range
+    u_int32_t min_id;
+    u_int32_t max_id;
+    u_int32_t limit;
+    u_int32_t offset;
+    // select where username or email = value, or like value (a trailing % makes it a prefix). the column is also the one
+    // create index builds an index on
+    bool text_where;
+    IndexColumn column;
+    bool like;
+    char where_value[COLUMN_EMAIL_SIZE + 2];
+    AggregateType aggregates[MAX_AGGREGATES];
+    u_int32_t num_aggregates;   // 0 for a select that returns rows
+    // the ?s of a prepared statement, left to right
+    Param* params;
+    u_int32_t num_params;
+    u_int32_t params_capacity;
 } Statement;
 
 // defines a quick way to grab the size of an attribute of an object (struct)
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
 
-// The following constants are for determing how row information will be stored in memory. Each row will contain an ID, a username, and an email, all of which will be adjacent in memory.
+// The following constants describe the columns of a row. On disk a row is stored compactly (see serialize_row()), and ROW_SIZE is the most space one can take.
 const u_int32_t ID_SIZE = size_of_attribute(Row, id);
 const u_int32_t USERNAME_SIZE = size_of_attribute(Row, username);
 const u_int32_t EMAIL_SIZE = size_of_attribute(Row, email);
@@ -70,9 +171,74 @@ const u_int32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
 const u_int32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
 const u_int32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
 
-// now we do more memory shenanigans to create the Table structure
-const uint32_t PAGE_SIZE = 4096;
-#define TABLE_MAX_PAGES 100
+/**
+ * now we do more memory shenanigans to create the Table structure. the page size is picked when a file is created and kept
+ * in its header (see db_file_page_size()), so it and the node capacities that follow from it are set once by set_page_size()
+ * before the file is opened, rather than being constants
+ */
+#define DEFAULT_PAGE_SIZE 4096
+#define MIN_PAGE_SIZE 4096
+// row offsets in a leaf's slots are 16 bits, which is as far as they reach
+#define MAX_PAGE_SIZE 65536
+u_int32_t PAGE_SIZE = DEFAULT_PAGE_SIZE;
+
+// the buffer pool caches this many pages by default. it can be changed with the --frames flag
+#define DEFAULT_POOL_FRAMES 1024
+// a single insert can pin a handful of pages at once (cursor, split siblings, parent), so we never go below this
+#define MIN_POOL_FRAMES 16
+#define NO_FRAME -1
+
+// automatic checkpoints kick in once this many pages are dirty, or after this many seconds. both can be changed on the command line
+#define DEFAULT_CHECKPOINT_PAGES 256
+#define DEFAULT_CHECKPOINT_SECONDS 30
+// a checkpoint hands at most this many contiguous pages to a single pwritev() call
+#define CHECKPOINT_MAX_IOVECS 256
+
+// in --mmap mode we reserve this much address space up front and map more of the file into it as the file grows,
+// so a page never moves once something holds a pointer to it
+#define MMAP_RESERVE_BYTES ((size_t)1 << 40)
+#define MMAP_MIN_GROW_PAGES 256
+// per page state kept in Pager.page_flags while in --mmap mode (frames keep the same thing in their own fields)
+#define PAGE_FLAG_DIRTY 1
+#define PAGE_FLAG_UNCOMMITTED 2
+
+// .load packs leaves and internal nodes this full (in percent) so later inserts have some room before they split
+#define DEFAULT_FILL_FACTOR 90
+// memory (in KB) the external sort behind .load may use for one sorted run of rows
+#define DEFAULT_SORT_MEMORY_KB 65536
+
+// .export formats rows into a buffer this big and writes it out whenever it fills up
+#define EXPORT_BUFFER_SIZE (1 << 20)
+// aggregate queries run on up to this many threads, and never on more than the buffer pool can keep pinned at once
+#define MAX_SCAN_THREADS 64
+#define SCAN_PINS_PER_THREAD 4
+// the key range of an aggregate query is cut into about this many pieces per thread, so a thread that finishes early can take
+// over some of the work of the others
+#define SCAN_PIECES_PER_THREAD 4
+// batch mode (-b or --script) collects output in a buffer this big instead of writing it a line at a time
+#define BATCH_OUTPUT_BUFFER_SIZE (1 << 20)
+// deep enough for any tree whose page numbers fit in 32 bits
+#define BULK_MAX_LEVELS 16
+// in concurrent mode page latches are allocated this many pages at a time, so a latch never moves once it exists
+#define LATCH_CHUNK_PAGES 1024
+// a select through an index reads at most this many row ids out of it before looking the rows up
+#define INDEX_SELECT_BATCH 64
+// size of the io_uring submission queue. a checkpoint hands the kernel up to this many runs of pages per io_uring_enter()
+#define IO_RING_ENTRIES 256
+// a prefetch reads at most this many pages, and never takes more than 1/PREFETCH_POOL_FRACTION of the buffer pool
+#define PREFETCH_MAX_PAGES 64
+#define PREFETCH_POOL_FRACTION 8
+// a scan's read-ahead window starts at this many leaves and doubles from there while the scan keeps up with it
+#define READAHEAD_MIN_PAGES 4
+// the server (--listen) reads from a connection this much at a time, and takes at most this many events from epoll at once
+#define SERVER_READ_SIZE 65536
+#define SERVER_MAX_EVENTS 64
+// a line a client sends can't be longer than this. past it the connection is dropped
+#define SERVER_MAX_LINE (1 << 20)
+// once this much of its replies is waiting to be sent, a connection isn't read from until the client catches up
+#define SERVER_MAX_PENDING_OUTPUT (8 << 20)
+// how often (in ms) an idle server wakes up to check whether it's time for a checkpoint
+#define SERVER_TICK_MS 1000
 
 
 // keeps track of node type for our B-tree data structure
@@ -81,6 +247,45 @@ typedef enum {
     NODE_LEAF
 } NodeType;
 
+// what the node type byte actually holds on disk. the two fixed size leaf layouts that came before slotted pages have their own
+// values, and get repacked into the current layout when they're read (see upgrade_legacy_leaf())
+#define NODE_TYPE_BYTE_INTERNAL 0
+#define NODE_TYPE_BYTE_LEGACY_LEAF 1
+#define NODE_TYPE_BYTE_PACKED_LEAF 2
+#define NODE_TYPE_BYTE_LEAF 3
+// a page on the freelist. it isn't part of the tree, and only holds the number of the next free page
+#define NODE_TYPE_BYTE_FREE 4
+// nodes of a secondary index (see the index node layout below)
+#define NODE_TYPE_BYTE_INDEX_LEAF 5
+#define NODE_TYPE_BYTE_INDEX_INTERNAL 6
+
+/**
+ * Page 0 of the file is a header rather than a node. It identifies the file and its format version and says where the root is.
+ * Files from before the header existed kept the root on page 0; those get their root moved when they're opened (see db_open()).
+ * Since no node can live on page 0 anymore, 0 also works as "no page" for next leaf pointers.
+ */
+#define DB_HEADER_MAGIC "mini-db\0"
+// version 2 added row counts to internal nodes, older files get theirs rebuilt when they're opened
+#define DB_FORMAT_VERSION 2
+#define DB_HEADER_PAGE_NUM 0
+const u_int32_t DB_HEADER_MAGIC_SIZE = 8;
+const u_int32_t DB_HEADER_MAGIC_OFFSET = 0;
+const u_int32_t DB_HEADER_VERSION_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_VERSION_OFFSET = DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE;
+const u_int32_t DB_HEADER_PAGE_SIZE_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_PAGE_SIZE_OFFSET = DB_HEADER_VERSION_OFFSET + DB_HEADER_VERSION_SIZE;
+const u_int32_t DB_HEADER_ROOT_PAGE_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_ROOT_PAGE_OFFSET = DB_HEADER_PAGE_SIZE_OFFSET + DB_HEADER_PAGE_SIZE_SIZE;
+// pages freed by deletes are chained into a list through their first bytes, so new nodes can reuse them before the file grows.
+// files from before the freelist have zeros here, which is an empty list
+const u_int32_t DB_HEADER_FREELIST_HEAD_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_FREELIST_HEAD_OFFSET = DB_HEADER_ROOT_PAGE_OFFSET + DB_HEADER_ROOT_PAGE_SIZE;
+const u_int32_t DB_HEADER_FREE_PAGES_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_FREE_PAGES_OFFSET = DB_HEADER_FREELIST_HEAD_OFFSET + DB_HEADER_FREELIST_HEAD_SIZE;
+// root page of the index on each IndexColumn, 0 if there is none. older files have zeros here too
+const u_int32_t DB_HEADER_INDEX_ROOT_SIZE = sizeof(u_int32_t);
+const u_int32_t DB_HEADER_INDEX_ROOTS_OFFSET = DB_HEADER_FREE_PAGES_OFFSET + DB_HEADER_FREE_PAGES_SIZE;
+
 // node header layout
 const u_int32_t NODE_TYPE_SIZE = sizeof(u_int8_t);
 const u_int32_t NODE_TYPE_OFFSET = 0;
@@ -97,32 +302,106 @@ const u_int32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const u_int32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(u_int32_t);
 const u_int32_t LEAF_NODE_NEXT_LEAF_OFFSET = 
     LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const u_int32_t LEAF_NODE_HEADER_SIZE = 
-    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
-
-// leaf node body layout
+const u_int32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(u_int32_t);
+const u_int32_t LEAF_NODE_CONTENT_START_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const u_int32_t LEAF_NODE_FRAGMENTED_SIZE = sizeof(u_int32_t);
+const u_int32_t LEAF_NODE_FRAGMENTED_OFFSET = LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+const u_int32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE
+    + LEAF_NODE_CONTENT_START_SIZE + LEAF_NODE_FRAGMENTED_SIZE;
+
+/**
+ * Leaf node body layout (slotted page). Rows are stored in their compact encoding (see serialize_row()) and take only as much
+ * space as they need. Each cell has a slot made of its key and the offset of its row:
+ *   header | keys[num_cells] | row offsets[num_cells] | free space | rows, packed against the end of the page
+ * The keys stay one contiguous sorted array so a search only reads a cache line or two of them. The slot directory grows
+ * upward and the rows grow downward from the end of the page, so the free space is always the gap in the middle, plus
+ * whatever rows were overwritten or removed (fragmented bytes) which compaction gives back.
+ */
 const u_int32_t LEAF_NODE_KEY_SIZE = sizeof(u_int32_t);
-const u_int32_t LEAF_NODE_KEY_OFFSET = 0;
-const u_int32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const u_int32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const u_int32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const u_int32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const u_int32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const u_int32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
-const u_int32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+const u_int32_t LEAF_NODE_ROW_OFFSET_SIZE = sizeof(u_int16_t);
+const u_int32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_ROW_OFFSET_SIZE;
+const u_int32_t LEAF_NODE_KEYS_OFFSET = (LEAF_NODE_HEADER_SIZE + 3) & ~3;
+u_int32_t LEAF_NODE_SPACE_FOR_CELLS;
+// the most cells a leaf can have, every row being as short as it gets (an id and two empty strings)
+u_int32_t LEAF_NODE_MAX_CELLS;
+// a leaf using fewer bytes than this after a delete borrows from or merges with a sibling. it's a third rather than half, so
+// a leaf that just split doesn't merge right back on the next delete
+u_int32_t LEAF_NODE_MIN_BYTES;
+// the binary search in leaf_node_lower_bound() hands off to a vector compare once this few keys are left
+#define LEAF_NODE_SIMD_WINDOW 16
+
+// the two fixed size layouts leaves had before, only read when upgrading old pages. every row took ROW_SIZE bytes:
+// a legacy leaf kept each key right in front of its row, a packed leaf kept up to 13 keys in an array and the rows after it
+const u_int32_t LEGACY_LEAF_CELLS_OFFSET = 14;
+const u_int32_t LEGACY_LEAF_CELL_SIZE = sizeof(u_int32_t) + ROW_SIZE;
+const u_int32_t PACKED_LEAF_KEYS_OFFSET = 16;
+const u_int32_t PACKED_LEAF_MAX_CELLS = 13;
 
 // internal node header layout
 const u_int32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(u_int32_t);
 const u_int32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const u_int32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(u_int32_t);
 const u_int32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+const u_int32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(u_int32_t);
+const u_int32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
 const u_int32_t INTERNAL_NODE_HEADER_SIZE = 
-    COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+    COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE + INTERNAL_NODE_RIGHT_COUNT_SIZE;
 
-// internal node body layout
+// internal node body layout. every child comes with the number of rows in its subtree, which is what lets count(*) and
+// offset work their way down the tree instead of walking leaves
 const u_int32_t INTERNAL_NODE_KEY_SIZE = sizeof(u_int32_t);
 const u_int32_t INTERNAL_NODE_CHILD_SIZE = sizeof(u_int32_t);
-const u_int32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const u_int32_t INTERNAL_NODE_COUNT_SIZE = sizeof(u_int32_t);
+const u_int32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_COUNT_SIZE;
+u_int32_t INTERNAL_NODE_SPACE_FOR_CELLS;
+u_int32_t INTERNAL_NODE_MAX_KEYS;
+// same idea as LEAF_NODE_MIN_BYTES, counted in keys
+u_int32_t INTERNAL_NODE_MIN_KEYS;
+
+// internal nodes before format version 2 had no counts: the same header without the right child's count, and cells of just
+// child and key. only read when rebuilding them (see rebuild_internal_nodes())
+const u_int32_t LEGACY_INTERNAL_NODE_CELLS_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const u_int32_t LEGACY_INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+
+// free page layout, the next pointer sits where a node keeps its parent
+const u_int32_t FREE_PAGE_NEXT_OFFSET = PARENT_POINTER_OFFSET;
+
+/**
+ * Index node layout. A secondary index is a B+tree of its own, keyed by a column's value plus the row's id. Its nodes share
+ * the common node header, but the keys vary in length, so leaves and internal nodes alike are slotted like table leaves:
+ *   header | entry offsets[num_cells] | free space | entries, packed against the end of the page
+ * A leaf entry is id | length | value. An internal entry puts its child in front of that, and the key is the biggest one in
+ * the child's subtree; the right child's is implied.
+ */
+const u_int32_t INDEX_NODE_NUM_CELLS_SIZE = sizeof(u_int32_t);
+const u_int32_t INDEX_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+// the next leaf for a leaf, the right child for an internal node
+const u_int32_t INDEX_NODE_LINK_SIZE = sizeof(u_int32_t);
+const u_int32_t INDEX_NODE_LINK_OFFSET = INDEX_NODE_NUM_CELLS_OFFSET + INDEX_NODE_NUM_CELLS_SIZE;
+const u_int32_t INDEX_NODE_CONTENT_START_SIZE = sizeof(u_int32_t);
+const u_int32_t INDEX_NODE_CONTENT_START_OFFSET = INDEX_NODE_LINK_OFFSET + INDEX_NODE_LINK_SIZE;
+const u_int32_t INDEX_NODE_HEADER_SIZE = INDEX_NODE_CONTENT_START_OFFSET + INDEX_NODE_CONTENT_START_SIZE;
+const u_int32_t INDEX_NODE_SLOT_SIZE = sizeof(u_int16_t);
+const u_int32_t INDEX_ENTRY_CHILD_SIZE = sizeof(u_int32_t);
+const u_int32_t INDEX_ENTRY_ID_SIZE = sizeof(u_int32_t);
+const u_int32_t INDEX_ENTRY_LENGTH_SIZE = sizeof(u_int8_t);
+const u_int32_t INDEX_ENTRY_MAX_SIZE = INDEX_ENTRY_CHILD_SIZE + INDEX_ENTRY_ID_SIZE + INDEX_ENTRY_LENGTH_SIZE + COLUMN_EMAIL_SIZE;
+
+// works out everything above that depends on the page size. page_size has to be a power of two from MIN_PAGE_SIZE to
+// MAX_PAGE_SIZE
+void set_page_size(u_int32_t page_size) {
+    PAGE_SIZE = page_size;
+    LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_KEYS_OFFSET;
+    LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / (LEAF_NODE_SLOT_SIZE + ID_SIZE + 2);
+    LEAF_NODE_MIN_BYTES = LEAF_NODE_SPACE_FOR_CELLS / 3;
+    INTERNAL_NODE_SPACE_FOR_CELLS = PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE;
+    INTERNAL_NODE_MAX_KEYS = INTERNAL_NODE_SPACE_FOR_CELLS / INTERNAL_NODE_CELL_SIZE;
+    INTERNAL_NODE_MIN_KEYS = INTERNAL_NODE_MAX_KEYS / 3;
+}
+
+bool valid_page_size(u_int32_t page_size) {
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
 
 // functions for reading and writing into internal nodes
 u_int32_t* internal_node_num_keys(void* node) {
@@ -150,745 +429,6725 @@ u_int32_t* internal_node_child(void* node, u_int32_t child_num) {
 }
 
 u_int32_t* internal_node_key(void* node, u_int32_t key_num) {
-    return internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+    return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+// rows in the subtree of a child, the right child's being kept in the header
+u_int32_t* internal_node_child_count(void* node, u_int32_t child_num) {
+    if (child_num == *internal_node_num_keys(node)) {
+        return node + INTERNAL_NODE_RIGHT_COUNT_OFFSET;
+    }
+    return (void*)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
 }
 
+// the write-ahead log lives next to the database file as "<filename>-wal". every statement appends the full image of each page it
+// modified followed by a commit record, so a crash before the next checkpoint can be repaired by replaying committed page images
+#define WAL_SUFFIX "-wal"
+// how many commits share a single fdatasync() by default. can be changed with --wal-group
+#define DEFAULT_WAL_GROUP 1
+// once the log grows past this many bytes we checkpoint and start it over
+#define WAL_CHECKPOINT_BYTES (16 * 1024 * 1024)
+
+typedef enum {
+    WAL_RECORD_PAGE = 1,
+    WAL_RECORD_COMMIT = 2
+} WalRecordType;
+
+// every record starts with this header. page records are followed by PAGE_SIZE bytes of page image, commit records by nothing
+typedef struct {
+    u_int32_t checksum;   // covers the rest of the header and the payload, so torn writes at the tail get noticed
+    u_int32_t type;
+    u_int64_t lsn;        // log sequence number, strictly increasing through the file
+    u_int32_t page_num;
+    u_int32_t payload_size;
+} WalRecordHeader;
+
+// the log index remembers where the newest image of a page sits in the log, for pages that had to leave the buffer pool
+// before their statement committed. get_page() reads those back from the log instead of the (older) database file
+#define WAL_NOT_LOGGED -1
+#define WAL_INDEX_EMPTY -2
+
+typedef struct {
+    u_int32_t page_num;
+    off_t offset;   // where the page image starts in the log, WAL_NOT_LOGGED, or WAL_INDEX_EMPTY for an unused slot
+} WalIndexEntry;
+
+typedef struct {
+    char* filename;
+    int file_descriptor;
+    off_t file_length;
+    u_int64_t next_lsn;
+    u_int32_t group_size;         // commits per fdatasync()
+    u_int32_t unsynced_commits;   // commits written to the log but not yet synced
+    u_int32_t* txn_pages;         // pages modified by the statement that is currently running
+    u_int32_t num_txn_pages;
+    u_int32_t txn_pages_capacity;
+    void* buffer;                 // one commit's worth of records, handed to a single write()
+    size_t buffer_capacity;
+    WalIndexEntry* index;         // open addressing hash table, page number -> log offset
+    u_int32_t index_capacity;
+    u_int32_t index_count;
+    bool replaying;
+} Wal;
+
+/**
+ * A bare-bones io_uring, set up with raw syscalls so there's no library to link against: a submission queue and a completion
+ * queue, both shared with the kernel. pager_io() queues a batch of reads or writes, submits all of them with one
+ * io_uring_enter() and waits for them together, so they're in flight at the same time instead of one after the other. Kernels
+ * without io_uring (or with it switched off, as in a lot of containers) leave Pager.ring NULL, and the pager sticks to
+ * preadv()/pwritev().
+ */
+#ifdef HAVE_IO_URING
+typedef struct {
+    int fd;
+    u_int32_t num_entries;
+    u_int32_t* sq_tail;
+    u_int32_t* sq_mask;
+    u_int32_t* sq_array;
+    struct io_uring_sqe* sqes;
+    u_int32_t* cq_head;
+    u_int32_t* cq_tail;
+    u_int32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_ring;            // the mappings behind the pointers above, kept for munmap()
+    size_t sq_ring_size;
+    void* cq_ring;            // the same as sq_ring on kernels that map both queues at once
+    size_t cq_ring_size;
+    size_t sqes_size;
+} IoRing;
+#else
+typedef struct {
+    int fd;
+} IoRing;
+#endif
+
+// one vectored read or write, for pager_io()
+typedef struct {
+    bool write;
+    int fd;
+    struct iovec* iov;
+    int iov_count;
+    off_t offset;
+} PageIo;
+
+// a Frame is one slot of the buffer pool. it holds a single page in memory along with the bookkeeping needed to decide when it can be evicted
+typedef struct {
+    void* data;
+    u_int32_t page_num;
+    u_int32_t pin_count;   // number of users currently holding a pointer into this page. pinned frames are never evicted
+    int32_t next;          // next frame in the same page table bucket
+    bool in_use;           // false while the frame is still empty
+    bool referenced;       // CLOCK reference bit, set on every access and cleared as the clock hand sweeps past
+    bool dirty;            // page was modified and must be written back before the frame is reused
+    bool uncommitted;      // modified by the running statement and not logged yet, so it must stay in memory
+} Frame;
+
+// a reader/writer latch guarding the contents of one page in concurrent mode
+typedef struct {
+    pthread_rwlock_t lock;
+    bool write_latched;    // held by the running write statement. only the writer's thread ever looks at this
+} PageLatch;
+
 // a Pager object helps connect a Table and its contents to a database file. it also helps navigate through such db files
+// pages are cached in a fixed number of frames. a hash table maps page numbers to frames and CLOCK picks a victim when the pool is full
 typedef struct {
     int file_descriptor;
-    u_int32_t file_length;
+    off_t file_length;
     u_int32_t num_pages;
-    void* pages[TABLE_MAX_PAGES];
+    u_int32_t num_frames;
+    Frame* frames;
+    void* pool;                 // one big allocation that backs every frame's data
+    int32_t* page_table;        // bucket heads, indexes into frames
+    u_int32_t page_table_mask;  // number of buckets - 1 (always a power of two)
+    u_int32_t clock_hand;
+    u_int32_t num_dirty;
+    u_int32_t checkpoint_pages;     // dirty page count that triggers an automatic checkpoint, 0 disables it
+    u_int32_t checkpoint_seconds;   // time between automatic checkpoints, 0 disables it
+    time_t last_checkpoint;
+    Wal* wal;                       // NULL when running with --no-wal
+    bool use_mmap;                  // pages are read straight out of a mapping of the file instead of frames
+    void* map;
+    u_int32_t mapped_pages;
+    u_int8_t* page_flags;
+    bool bulk_loading;              // pages written by .load skip the log, see table_bulk_load()
+    pthread_mutex_t latch;          // lets the threads of a parallel scan (or of concurrent mode) share the pool and the log
+    bool shared;                    // set while those threads run, the latch is skipped otherwise
+    bool concurrent;                // statements can run on several threads at once, see "Concurrent mode"
+    PageLatch** latch_chunks;       // LATCH_CHUNK_PAGES page latches each, allocated as the pages get used
+    u_int32_t num_latch_chunks;
+    u_int32_t* write_latches;       // pages latched by the running write statement, released once it commits
+    u_int32_t num_write_latches;
+    u_int32_t write_latches_capacity;
+    IoRing* ring;                   // NULL without io_uring, see pager_io()
 } Pager;
 
 // defines our Table object. num_rows describes size of the table and pager is a data type that helps access pages within a table
 typedef struct {
     Pager* pager;
     u_int32_t root_page_num;
+    u_int32_t fill_factor;          // used by .load, and by splits at the right edge of the tree
+    u_int32_t rightmost_leaf;       // last leaf of the table as of the last insert, 0 if not known. only a hint, see table_find_insert()
+    size_t sort_memory;
+    u_int32_t num_threads;          // workers for aggregate queries
+    u_int32_t index_roots[NUM_INDEX_COLUMNS];   // a copy of the header's, 0 for a column without an index
+    pthread_mutex_t writer;         // one write statement at a time in concurrent mode
 } Table;
 
+// settings picked on the command line that control how the database gets opened
+typedef struct {
+    u_int32_t num_frames;
+    u_int32_t checkpoint_pages;
+    u_int32_t checkpoint_seconds;
+    bool use_wal;
+    u_int32_t wal_group;
+    bool use_mmap;
+    u_int32_t fill_factor;
+    u_int32_t sort_memory_kb;
+    u_int32_t num_threads;
+    bool concurrent;
+    bool use_io_uring;              // falls back to preadv()/pwritev() by itself if the kernel doesn't have it
+    u_int32_t page_size;            // for a new file, an existing one keeps the size it was created with
+} DbOptions;
+
 // defines a Cursor object which is designed to help navigate through the database table. it is defined with a Table so that all cursor functions only require a Cursor parameter.
+// how far ahead of a scan the pager reads, see scan_readahead()
+typedef struct {
+    u_int32_t leaves_moved;   // leaves the scan has stepped onto
+    u_int32_t window;         // leaves loaded into the pool per read-ahead, 0 until it looks like a scan
+    u_int32_t mark;           // the leaf that sets off the next read-ahead when the scan gets to it
+    u_int32_t ahead;          // leaves loaded ahead that the scan hasn't got to yet
+} Readahead;
+
 typedef struct {
     Table* table;
     u_int32_t page_num;
     u_int32_t cell_num;
     bool end_of_table;
+    Readahead readahead;
 } Cursor;
 
-// get_page() will do one of the following three things: (1) find the requested page in memory, (2) if no page exists in memory, allocate space for it, (3) returns error if page limit is exceeded
-void* get_page(Pager* pager, u_int32_t page_num) {
-    if (page_num > TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
-    }
-
-    if (pager->pages[page_num] == NULL) {
-        // cache miss!! allocate memory and load from file
-        void* page = malloc(PAGE_SIZE);
-        u_int32_t num_pages = pager->file_length / PAGE_SIZE;
-
-        // could potentially save part of an extra page at the end of the file
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages += 1;
-        }
-
-        if (page_num <= num_pages) {
-            // moves 
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
-            }
-        }
-
-        pager->pages[page_num] = page;
+// multiplicative hash so that consecutive page numbers spread out over the buckets
+u_int32_t page_table_bucket(Pager* pager, u_int32_t page_num) {
+    return (page_num * 2654435761u) & pager->page_table_mask;
+}
 
-        if (page_num >= pager->num_pages) {
-            pager->num_pages = page_num + 1;
+// returns the frame holding page_num, or NO_FRAME if the page isn't cached
+int32_t pager_lookup(Pager* pager, u_int32_t page_num) {
+    int32_t frame_index = pager->page_table[page_table_bucket(pager, page_num)];
+    while (frame_index != NO_FRAME) {
+        if (pager->frames[frame_index].page_num == page_num) {
+            return frame_index;
         }
+        frame_index = pager->frames[frame_index].next;
     }
-
-    return pager->pages[page_num];
-
-}
-
-// getter/setter for root node
-bool is_node_root(void* node) {
-    u_int8_t value = *((u_int8_t*)(node + IS_ROOT_OFFSET));
-    return (bool)value;
+    return NO_FRAME;
 }
 
-void set_node_root(void* node, bool is_root) {
-    u_int8_t value = is_root;
-    *((u_int8_t*)(node + IS_ROOT_OFFSET)) = value;
+void page_table_insert(Pager* pager, int32_t frame_index) {
+    u_int32_t bucket = page_table_bucket(pager, pager->frames[frame_index].page_num);
+    pager->frames[frame_index].next = pager->page_table[bucket];
+    pager->page_table[bucket] = frame_index;
 }
 
-u_int32_t* leaf_node_next_leaf(void* node) {
-    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+void page_table_remove(Pager* pager, int32_t frame_index) {
+    int32_t* link = &pager->page_table[page_table_bucket(pager, pager->frames[frame_index].page_num)];
+    while (*link != frame_index) {
+        link = &pager->frames[*link].next;
+    }
+    *link = pager->frames[frame_index].next;
 }
 
-// some pointer arithmetic functions that return pointers to values, so the functions can be used both as getters and setters
-u_int32_t* leaf_node_num_cells(void* node) {
-    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+// makes every commit written so far durable with one fdatasync(). this is the "group" in group commit
+void wal_sync(Wal* wal) {
+    if (wal->unsynced_commits == 0) {
+        return;
+    }
+    if (fdatasync(wal->file_descriptor) == -1) {
+        printf("Error syncing wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal->unsynced_commits = 0;
 }
 
-void* leaf_node_cell(void* node, u_int32_t cell_num) {
-    return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
-}
+// throws the log away once a checkpoint has put every page it describes into the database file
+void wal_truncate(Wal* wal) {
+    if (ftruncate(wal->file_descriptor, 0) == -1 || fsync(wal->file_descriptor) == -1) {
+        printf("Error truncating wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal->file_length = 0;
+    wal->unsynced_commits = 0;
 
-u_int32_t* leaf_node_key(void* node, u_int32_t cell_num) {
-    return leaf_node_cell(node, cell_num);
+    for (u_int32_t i = 0; i < wal->index_capacity; i++) {
+        wal->index[i].offset = WAL_INDEX_EMPTY;
+    }
+    wal->index_count = 0;
 }
 
-void* leaf_node_value(void* node, u_int32_t cell_num) {
-    return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+// FNV-1a. cheap, and good enough to tell a torn or half-written record from a real one
+u_int32_t wal_checksum(u_int32_t hash, const void* data, size_t length) {
+    const u_int8_t* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
 }
 
-void set_node_type(void* node, NodeType type) {
-    u_int8_t value = type;
-    *((u_int8_t*)(node + NODE_TYPE_OFFSET)) = value;
+u_int32_t wal_record_checksum(WalRecordHeader* header, const void* payload) {
+    u_int32_t hash = wal_checksum(2166136261u, (u_int8_t*)header + sizeof(header->checksum),
+                                  sizeof(WalRecordHeader) - sizeof(header->checksum));
+    return wal_checksum(hash, payload, header->payload_size);
 }
 
-void initialize_leaf_node(void* node) {
-    set_node_type(node, NODE_LEAF);
-    set_node_root(node, false);
-    *leaf_node_num_cells(node) = 0;
-    *leaf_node_next_leaf(node) = 0; // 0 means there is no sibling and thus this node is the last child of its parent
+// appends one record to the commit buffer
+void wal_buffer_record(Wal* wal, size_t* buffer_length, WalRecordType type, u_int32_t page_num, void* payload, u_int32_t payload_size) {
+    WalRecordHeader* header = wal->buffer + *buffer_length;
+    header->type = type;
+    header->lsn = wal->next_lsn++;
+    header->page_num = page_num;
+    header->payload_size = payload_size;
+    if (payload_size > 0) {
+        memcpy((void*)(header + 1), payload, payload_size);
+    }
+    header->checksum = wal_record_checksum(header, payload);
+    *buffer_length += sizeof(WalRecordHeader) + payload_size;
 }
 
-void initialize_internal_node(void* node) {
-    set_node_type(node, NODE_INTERNAL);
-    set_node_root(node, false);
-    *internal_node_num_keys(node) = 0;
+u_int32_t wal_index_slot(Wal* wal, u_int32_t page_num) {
+    u_int32_t mask = wal->index_capacity - 1;
+    u_int32_t slot = (page_num * 2654435761u) & mask;
+    while (wal->index[slot].page_num != page_num && wal->index[slot].offset != WAL_INDEX_EMPTY) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
 }
 
-NodeType get_node_type(void* node) {
-    u_int8_t value = *((u_int8_t*)(node + NODE_TYPE_OFFSET));
-    return (NodeType)value;
+off_t wal_index_lookup(Wal* wal, u_int32_t page_num) {
+    if (wal->index_count == 0) {
+        return WAL_NOT_LOGGED;
+    }
+    u_int32_t slot = wal_index_slot(wal, page_num);
+    return wal->index[slot].offset == WAL_INDEX_EMPTY ? WAL_NOT_LOGGED : wal->index[slot].offset;
 }
 
-// search for a leaf node using binary search
-Cursor* leaf_node_find(Table* table, u_int32_t page_num, u_int32_t key) {
-    void* node = get_page(table->pager, page_num);
-    u_int32_t num_cells = *leaf_node_num_cells(node);
-
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = page_num;
-
-    // binary search
-    u_int32_t min_index = 0;
-    u_int32_t one_past_max_index = num_cells;
-    
-    while (one_past_max_index != min_index) {
-        u_int32_t index = (min_index + one_past_max_index) / 2;
-        u_int32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
+void wal_index_set(Wal* wal, u_int32_t page_num, off_t offset) {
+    // keep the table at most half full so probe chains stay short
+    if (2 * (wal->index_count + 1) > wal->index_capacity) {
+        WalIndexEntry* old_index = wal->index;
+        u_int32_t old_capacity = wal->index_capacity;
+        wal->index_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+        wal->index = malloc(wal->index_capacity * sizeof(WalIndexEntry));
+        for (u_int32_t i = 0; i < wal->index_capacity; i++) {
+            wal->index[i].offset = WAL_INDEX_EMPTY;
         }
-        if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
+        for (u_int32_t i = 0; i < old_capacity; i++) {
+            if (old_index[i].offset != WAL_INDEX_EMPTY) {
+                wal->index[wal_index_slot(wal, old_index[i].page_num)] = old_index[i];
+            }
         }
+        free(old_index);
     }
 
-    cursor->cell_num = min_index;
-    return cursor;
+    u_int32_t slot = wal_index_slot(wal, page_num);
+    if (wal->index[slot].offset == WAL_INDEX_EMPTY) {
+        wal->index_count += 1;
+    }
+    wal->index[slot].page_num = page_num;
+    wal->index[slot].offset = offset;
 }
 
-Cursor* internal_node_find(Table* table, u_int32_t page_num, u_int32_t key) {
-    void* node = get_page(table->pager, page_num);
-    u_int32_t num_keys = *internal_node_num_keys(node);
-
-    // binary search to find index of child to look for
-    u_int32_t min_index = 0;
-    u_int32_t max_index = num_keys;
+// called when a page goes to the database file, which makes any image of it in the log stale
+void wal_index_forget(Wal* wal, u_int32_t page_num) {
+    if (wal_index_lookup(wal, page_num) != WAL_NOT_LOGGED) {
+        wal_index_set(wal, page_num, WAL_NOT_LOGGED);
+    }
+}
 
-    while (min_index != max_index) {
-        u_int32_t index = (min_index + max_index) / 2;
-        u_int32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
-            min_index = index + 1;
-        }
+// evicting a page that the running statement modified. it can't go to the database file yet because the statement might
+// never commit, so its image is appended to the log instead, without a commit record. if the statement does commit, its commit
+// record covers this image too. if it doesn't, recovery ignores it
+void wal_steal_page(Wal* wal, u_int32_t page_num, void* data) {
+    size_t needed = sizeof(WalRecordHeader) + PAGE_SIZE;
+    if (needed > wal->buffer_capacity) {
+        wal->buffer_capacity = needed;
+        wal->buffer = realloc(wal->buffer, needed);
     }
+    size_t buffer_length = 0;
+    wal_buffer_record(wal, &buffer_length, WAL_RECORD_PAGE, page_num, data, PAGE_SIZE);
 
-    u_int32_t child_num = *internal_node_child(node, min_index);
-    void* child = get_page(table->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
+    ssize_t bytes_written = pwrite(wal->file_descriptor, wal->buffer, buffer_length, wal->file_length);
+    if (bytes_written != (ssize_t)buffer_length) {
+        printf("Error writing wal: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
+    wal_index_set(wal, page_num, wal->file_length + sizeof(WalRecordHeader));
+    wal->file_length += buffer_length;
 }
 
-// returns the position of the given key in the tree. if key isn't present, return the position where it should be inserted
-Cursor* table_find(Table* table, u_int32_t key) {
-    u_int32_t root_page_num = table->root_page_num;
-    void* root_node = get_page(table->pager, root_page_num);
+// where a page starts in the database file. page numbers are 32 bits but byte offsets are not, so the product has to be
+// done in 64 bits or every page past the first 4 GB wraps around onto the start of the file
+off_t page_offset(u_int32_t page_num) {
+    return (off_t)page_num * PAGE_SIZE;
+}
 
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
-    } else {
-        return internal_node_find(table, root_page_num, key);
+// sets up a ring with room for num_entries requests. NULL if the kernel won't give us one
+IoRing* io_ring_open(u_int32_t num_entries) {
+#ifdef HAVE_IO_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, num_entries, &params);
+    if (fd < 0) {
+        return NULL;
     }
-}
 
-Cursor* table_start(Table* table) {
-    Cursor* cursor = table_find(table, 0);
+    IoRing* ring = calloc(1, sizeof(IoRing));
+    ring->fd = fd;
+    ring->num_entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u_int32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
 
-    void* node = get_page(table->pager, cursor->page_num);
-    u_int32_t num_cells = *leaf_node_num_cells(node);
-    cursor->end_of_table = (num_cells == 0);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring
+        : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (!single_mmap && ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        close(fd);
+        free(ring);
+        return NULL;
+    }
 
-    return cursor;
+    ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+    ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ring + params.sq_off.array;
+    ring->cq_head = ring->cq_ring + params.cq_off.head;
+    ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+    ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+    ring->cqes = ring->cq_ring + params.cq_off.cqes;
+    return ring;
+#else
+    (void)num_entries;
+    return NULL;
+#endif
 }
 
-void print_row(Row* row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+void io_ring_close(IoRing* ring) {
+#ifdef HAVE_IO_URING
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+#endif
+    close(ring->fd);
+    free(ring);
 }
 
-// function that converts Row objects to our compact memory setup
-void serialize_row(Row* source, void* destination) {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-    memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+#ifdef HAVE_IO_URING
+// fills in the next submission queue entry. nothing reaches the kernel until io_uring_enter()
+void io_ring_queue(IoRing* ring, PageIo* io, u_int64_t user_data) {
+    u_int32_t tail = *ring->sq_tail;
+    u_int32_t index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = io->write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = io->fd;
+    sqe->addr = (u_int64_t)(uintptr_t)io->iov;
+    sqe->len = io->iov_count;
+    sqe->off = io->offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    // the kernel reads the entry once it sees the new tail, so the entry has to be written out first
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
 }
-// does literally the opposite
-void deserialize_row(void* source, Row* destination) {
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+
+// takes one completion off the queue. false if there isn't one yet
+bool io_ring_reap(IoRing* ring, u_int64_t* user_data, int32_t* result) {
+    u_int32_t head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+#endif
+
+// drops the first done bytes from an iovec array
+void iovec_advance(struct iovec** iov, int* iov_count, size_t done) {
+    while (*iov_count > 0 && done >= (*iov)->iov_len) {
+        done -= (*iov)->iov_len;
+        (*iov)++;
+        (*iov_count)--;
+    }
+    if (*iov_count > 0) {
+        (*iov)->iov_base += done;
+        (*iov)->iov_len -= done;
+    }
 }
 
-// table_end() also creates a new Cursor, but places it at the end of the Table
-Cursor* table_end(Table* table) {
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = table->root_page_num;
+// preadv() and pwritev() are allowed to do less than we asked for, so keep going until all of it is done. a read that runs
+// into the end of the file leaves the rest of its buffers zeroed, like a page that was never written
+void io_vectored(PageIo* io) {
+    struct iovec* iov = io->iov;
+    int iov_count = io->iov_count;
+    off_t offset = io->offset;
+    while (iov_count > 0) {
+        ssize_t done = io->write ? pwritev(io->fd, iov, iov_count, offset) : preadv(io->fd, iov, iov_count, offset);
+        if (done == -1 && errno == EINTR) {
+            continue;
+        }
+        if (done == -1) {
+            printf(io->write ? "Error writing: %d\n" : "Error reading file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (done == 0 && !io->write) {
+            for (int i = 0; i < iov_count; i++) {
+                memset(iov[i].iov_base, 0, iov[i].iov_len);
+            }
+            return;
+        }
+        offset += done;
+        iovec_advance(&iov, &iov_count, done);
+    }
+}
 
-    void* root_node = get_page(table->pager, table->root_page_num);
-    u_int32_t num_cells = *leaf_node_num_cells(root_node);
-    cursor->cell_num = num_cells;
-    cursor->end_of_table = true;
+// runs a batch of reads and writes, which must not overlap. with io_uring a whole submission queue's worth is in flight at
+// once, otherwise they go one after the other. either way all of them are done when this returns
+void pager_io(Pager* pager, PageIo* ios, u_int32_t count) {
+#ifdef HAVE_IO_URING
+    IoRing* ring = pager->ring;
+    for (u_int32_t start = 0; ring != NULL && start < count; start += ring->num_entries) {
+        u_int32_t batch = count - start < ring->num_entries ? count - start : ring->num_entries;
+        for (u_int32_t i = 0; i < batch; i++) {
+            io_ring_queue(ring, &ios[start + i], start + i);
+        }
 
-    return cursor;
-}
+        u_int32_t submitted = 0;
+        u_int32_t completed = 0;
+        while (completed < batch) {
+            int entered = syscall(__NR_io_uring_enter, ring->fd, batch - submitted, batch - completed,
+                                  IORING_ENTER_GETEVENTS, NULL, 0);
+            if (entered == -1 && errno != EINTR) {
+                printf("Error submitting I/O: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+            if (entered > 0) {
+                submitted += entered;
+            }
 
-// cursor_value() replaces previous row_slot() function. it returns the location of the cursor within its associated table.
-void* cursor_value(Cursor* cursor) {
-    u_int32_t page_num = cursor->page_num;
-    void* page = get_page(cursor->table->pager, page_num);
+            u_int64_t index;
+            int32_t result;
+            while (io_ring_reap(ring, &index, &result)) {
+                completed++;
+                PageIo* io = &ios[index];
+                if (result < 0 && result != -EINTR && result != -EAGAIN) {
+                    printf(io->write ? "Error writing: %d\n" : "Error reading file: %d\n", -result);
+                    exit(EXIT_FAILURE);
+                }
+                // whatever the kernel didn't get to (a short transfer, or one it asks us to retry) is finished the slow way
+                size_t done = result < 0 ? 0 : result;
+                size_t total = 0;
+                for (int i = 0; i < io->iov_count; i++) {
+                    total += io->iov[i].iov_len;
+                }
+                if (done < total) {
+                    io->offset += done;
+                    iovec_advance(&io->iov, &io->iov_count, done);
+                    io_vectored(io);
+                }
+            }
+        }
+    }
+    if (ring != NULL) {
+        return;
+    }
+#endif
+    for (u_int32_t i = 0; i < count; i++) {
+        io_vectored(&ios[i]);
+    }
+}
 
-    return leaf_node_value(page, cursor->cell_num);
+// writes a single page from its frame back to the database file
+void pager_write_frame(Pager* pager, Frame* frame) {
+    off_t offset = page_offset(frame->page_num);
+    ssize_t bytes_written = pwrite(pager->file_descriptor, frame->data, PAGE_SIZE, offset);
+    if (bytes_written != PAGE_SIZE) {
+        printf("Error writing: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    if (pager->file_length < offset + PAGE_SIZE) {
+        pager->file_length = offset + PAGE_SIZE;
+    }
+    if (frame->dirty) {
+        frame->dirty = false;
+        pager->num_dirty -= 1;
+    }
 }
 
-// moves the cursor forward in the table. really simple, just increments row number and checks if the end of the table is reached
-void cursor_advance(Cursor* cursor) {
-    u_int32_t page_num = cursor->page_num;
-    void* node = get_page(cursor->table->pager, page_num);
+// CLOCK replacement: sweep the frames in a circle, giving every referenced frame a second chance. pinned frames are skipped entirely.
+// two full sweeps are enough to clear every reference bit, so if we still haven't found anything then every frame is pinned
+// and we give back NO_FRAME
+int32_t pager_find_victim(Pager* pager) {
+    for (u_int32_t step = 0; step < 2 * pager->num_frames; step++) {
+        int32_t frame_index = pager->clock_hand;
+        Frame* frame = &pager->frames[frame_index];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+        if (!frame->in_use) {
+            return frame_index;
+        }
+        if (frame->pin_count > 0) {
+            continue;
+        }
+        if (frame->referenced) {
+            frame->referenced = false;
+            continue;
+        }
+        return frame_index;
+    }
+    return NO_FRAME;
+}
 
-    cursor->cell_num += 1;
-    if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-        /* Go to next leaf node!! */
-        u_int32_t next_page_num = *leaf_node_next_leaf(node);
-        if (next_page_num == 0) {
-            /* we're at the rightmost leaf!! no more siblings left */
-            cursor->end_of_table = true;
-        } else {
-            cursor->page_num = next_page_num;
-            cursor->cell_num = 0;
+// picks a victim and empties it out: a dirty page is written back first, and the page leaves the page table. NO_FRAME if
+// every frame is pinned
+int32_t pager_claim_frame(Pager* pager) {
+    int32_t frame_index = pager_find_victim(pager);
+    if (frame_index == NO_FRAME) {
+        return NO_FRAME;
+    }
+    Frame* frame = &pager->frames[frame_index];
+    if (frame->in_use) {
+        if (frame->dirty && pager->wal != NULL && frame->uncommitted) {
+            // the statement that modified this page is still running, so it goes to the log rather than the file
+            wal_steal_page(pager->wal, frame->page_num, frame->data);
+            frame->dirty = false;
+            pager->num_dirty -= 1;
+        } else if (frame->dirty) {
+            // write-ahead rule: the log records describing this page have to be durable before the page itself hits the file
+            if (pager->wal != NULL) {
+                wal_sync(pager->wal);
+                wal_index_forget(pager->wal, frame->page_num);
+            }
+            pager_write_frame(pager, frame);
         }
+        page_table_remove(pager, frame_index);
+        frame->in_use = false;
     }
+    return frame_index;
 }
 
-// opens the database file and keeps track of its size in memory
-Pager* pager_open(const char* filename) {
-    /**
-     * O_RDWR: Read/write mode
-     * O_CREAT: Create file if it doesn't exist
-     * S_IWUSR: User write permission
-     * S_IRUSR: User read permission
-    */
-    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
-    
-    if (fd == -1) {
-        printf("Unable to open file\n");
+// maps more of the file so that page_num is covered. the file is grown with ftruncate() first since touching a mapping past
+// the end of the file is a SIGBUS. MAP_PRIVATE keeps our writes out of the file until a checkpoint puts them there on purpose,
+// which is what the write-ahead log relies on
+void pager_grow_mapping(Pager* pager, u_int32_t min_pages) {
+    u_int32_t new_pages = pager->mapped_pages * 2;
+    if (new_pages < MMAP_MIN_GROW_PAGES) {
+        new_pages = MMAP_MIN_GROW_PAGES;
+    }
+    if (new_pages < min_pages) {
+        new_pages = min_pages;
+    }
+    if ((size_t)page_offset(new_pages) > MMAP_RESERVE_BYTES) {
+        printf("Database is too large for mmap mode.\n");
         exit(EXIT_FAILURE);
     }
 
-    // off_t is a data type used for I/O functionality. among other things its used to handle potentially large files
-    off_t file_length = lseek(fd, 0, SEEK_END);
-
-    Pager* pager = malloc(sizeof(Pager));
-    pager->file_descriptor = fd;
-    pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
-
-    if (file_length % PAGE_SIZE != 0) {
-        printf("Db file is not a whole number of pages. Corrupt file.\n");
+    off_t new_length = page_offset(new_pages);
+    if (pager->file_length < new_length && ftruncate(pager->file_descriptor, new_length) == -1) {
+        printf("Error growing db file: %d\n", errno);
         exit(EXIT_FAILURE);
     }
+    if (pager->file_length < new_length) {
+        pager->file_length = new_length;
+    }
 
-    for (u_int32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+    size_t old_bytes = page_offset(pager->mapped_pages);
+    void* mapped = mmap(pager->map + old_bytes, new_length - old_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_FIXED, pager->file_descriptor, old_bytes);
+    if (mapped == MAP_FAILED) {
+        printf("Error mapping db file: %d\n", errno);
+        exit(EXIT_FAILURE);
     }
 
-    return pager;
+    pager->page_flags = realloc(pager->page_flags, new_pages);
+    memset(pager->page_flags + pager->mapped_pages, 0, new_pages - pager->mapped_pages);
+    pager->mapped_pages = new_pages;
 }
 
-// function that establishes a connection to the database file. this function replaces the previous new_table(), and now takes the file name as its only parameter
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
+// get_page() will do one of the following things: (1) find the requested page in the buffer pool, (2) if it isn't cached, evict a frame (writing it back if dirty) and load the page into it.
+// the page comes back pinned, so the pointer stays valid until the caller hands it back with unpin_page()
+void upgrade_legacy_leaf(void* node);
 
-    Table* table = (Table*)malloc(sizeof(Table));
-    table->pager = pager;
-    table->root_page_num = 0;
+void* pager_pin_page(Pager* pager, u_int32_t page_num) {
+    if (pager->use_mmap) {
+        // no copies and no syscalls, the page is just an offset into the mapping
+        if (page_num >= pager->mapped_pages) {
+            pager_grow_mapping(pager, page_num + 1);
+        }
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
+        void* page = pager->map + page_offset(page_num);
+        upgrade_legacy_leaf(page);
+        return page;
+    }
 
-    if (pager->num_pages == 0) {
-        void* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+    int32_t frame_index = pager_lookup(pager, page_num);
+
+    if (frame_index == NO_FRAME) {
+        // cache miss!! grab a frame and load from file
+        frame_index = pager_claim_frame(pager);
+        if (frame_index == NO_FRAME) {
+            printf("Buffer pool exhausted, all %d frames are pinned.\n", pager->num_frames);
+            exit(EXIT_FAILURE);
+        }
+        Frame* frame = &pager->frames[frame_index];
+
+        u_int32_t num_pages = pager->file_length / PAGE_SIZE;
+
+        // could potentially save part of an extra page at the end of the file
+        if (pager->file_length % PAGE_SIZE) {
+            num_pages += 1;
+        }
+
+        off_t wal_offset = pager->wal != NULL ? wal_index_lookup(pager->wal, page_num) : WAL_NOT_LOGGED;
+        bool from_wal = wal_offset != WAL_NOT_LOGGED;
+        if (from_wal) {
+            // the newest copy of this page was pushed out to the log, the database file doesn't have it yet
+            if (pread(pager->wal->file_descriptor, frame->data, PAGE_SIZE, wal_offset) != PAGE_SIZE) {
+                printf("Error reading wal: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+        } else if (page_num < num_pages) {
+            ssize_t bytes_read = pread(pager->file_descriptor, frame->data, PAGE_SIZE, page_offset(page_num));
+            if (bytes_read == -1) {
+                printf("Error reading file: %d\n", errno);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            // brand new page past the end of the file
+            memset(frame->data, 0, PAGE_SIZE);
+        }
+
+        frame->page_num = page_num;
+        frame->pin_count = 0;
+        frame->in_use = true;
+        // a page that came out of the log still has to reach the database file at the next checkpoint
+        frame->dirty = from_wal;
+        if (from_wal) {
+            pager->num_dirty += 1;
+        }
+        frame->uncommitted = false;
+        page_table_insert(pager, frame_index);
+
+        if (page_num >= pager->num_pages) {
+            pager->num_pages = page_num + 1;
+        }
     }
 
-    return table;
+    Frame* frame = &pager->frames[frame_index];
+    frame->pin_count += 1;
+    frame->referenced = true;
+    upgrade_legacy_leaf(frame->data);
+    return frame->data;
 }
 
-void pager_flush(Pager* pager, u_int32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Tried to flush null page\n");
-        exit(EXIT_FAILURE);
+/**
+ * Reads pages into the pool before anyone asks for them. Pages that sit next to each other in the file are read with one
+ * vectored read, and with io_uring all of the reads are in flight at once, so a scan about to walk a run of leaves that aren't
+ * cached waits about as long as it would for one of them instead of for each in turn. Pages that are cached already, whose
+ * newest image is in the log or that are past the end of the file are left alone. Nothing is prefetched in mmap mode or while
+ * threads share the pool.
+ */
+bool pager_can_prefetch(Pager* pager) {
+    return !pager->use_mmap && !pager->shared;
+}
+
+// the most pages one prefetch reads
+u_int32_t pager_prefetch_limit(Pager* pager) {
+    u_int32_t limit = pager->num_frames / PREFETCH_POOL_FRACTION;
+    return limit > PREFETCH_MAX_PAGES ? PREFETCH_MAX_PAGES : limit < 1 ? 1 : limit;
+}
+
+void pager_prefetch(Pager* pager, u_int32_t* page_nums, u_int32_t count) {
+    if (!pager_can_prefetch(pager)) {
+        return;
+    }
+    if (count > pager_prefetch_limit(pager)) {
+        count = pager_prefetch_limit(pager);
     }
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+    PageIo ios[PREFETCH_MAX_PAGES];
+    struct iovec iovs[PREFETCH_MAX_PAGES];
+    int32_t frames[PREFETCH_MAX_PAGES];
+    u_int32_t num_reads = 0;
+    u_int32_t num_frames = 0;
+    u_int32_t file_pages = pager->file_length / PAGE_SIZE;
+    for (u_int32_t i = 0; i < count; i++) {
+        u_int32_t page_num = page_nums[i];
+        if (page_num >= file_pages || pager_lookup(pager, page_num) != NO_FRAME
+            || (pager->wal != NULL && wal_index_lookup(pager->wal, page_num) != WAL_NOT_LOGGED)) {
+            continue;
+        }
+        int32_t frame_index = pager_claim_frame(pager);
+        if (frame_index == NO_FRAME) {
+            break;
+        }
+        // the frame goes into the page table right away, pinned until its read is done so it can't be claimed twice
+        Frame* frame = &pager->frames[frame_index];
+        frame->page_num = page_num;
+        frame->pin_count = 1;
+        frame->in_use = true;
+        frame->referenced = true;
+        frame->dirty = false;
+        frame->uncommitted = false;
+        page_table_insert(pager, frame_index);
+
+        iovs[num_frames].iov_base = frame->data;
+        iovs[num_frames].iov_len = PAGE_SIZE;
+        // the page right after the one before goes on the end of the same read
+        PageIo* last = num_reads > 0 ? &ios[num_reads - 1] : NULL;
+        if (last != NULL && last->offset + (off_t)last->iov_count * PAGE_SIZE == page_offset(page_num)) {
+            last->iov_count++;
+        } else {
+            ios[num_reads].write = false;
+            ios[num_reads].fd = pager->file_descriptor;
+            ios[num_reads].iov = &iovs[num_frames];
+            ios[num_reads].iov_count = 1;
+            ios[num_reads].offset = page_offset(page_num);
+            num_reads++;
+        }
+        frames[num_frames++] = frame_index;
     }
 
-    ssize_t bytes_written = 
-        write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+    pager_io(pager, ios, num_reads);
+    for (u_int32_t i = 0; i < num_frames; i++) {
+        pager->frames[frames[i]].pin_count = 0;
+    }
+}
 
-    if (bytes_written == -1) {
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
+// tells the kernel these pages will be wanted soon, so it reads them into the page cache in the background while we get on
+// with something else. neighbouring pages are asked for as one range
+void pager_hint(Pager* pager, u_int32_t* page_nums, u_int32_t count) {
+    u_int32_t i = 0;
+    while (i < count) {
+        u_int32_t run_start = page_nums[i];
+        u_int32_t run_length = 1;
+        while (i + run_length < count && page_nums[i + run_length] == run_start + run_length) {
+            run_length++;
+        }
+        i += run_length;
+        if (pager->use_mmap) {
+            if (run_start + run_length <= pager->mapped_pages) {
+                madvise(pager->map + page_offset(run_start), (size_t)run_length * PAGE_SIZE, MADV_WILLNEED);
+            }
+        } else {
+            posix_fadvise(pager->file_descriptor, page_offset(run_start), (off_t)run_length * PAGE_SIZE, POSIX_FADV_WILLNEED);
+        }
     }
 }
 
-// for now, append new pages to the end of the database file. in the future, we'll recycle freed up space instead
-u_int32_t get_unused_page_num(Pager* pager) {
-    return pager->num_pages;
+/**
+ * Concurrent mode. With DbOptions.concurrent set, execute_statement() may be called from several threads at once: any number of
+ * selects run next to one write statement, and write statements queue up on Table.writer. The pool's bookkeeping stays under
+ * the pager's latch for good, and each page gets a reader/writer latch on top of that.
+ *  - The writer latches a page exclusively the first time it touches it (get_page() does it) and keeps every latch until the
+ *    statement has committed, so readers never see half of a statement. What it touches is the path down to the leaves it works
+ *    on, plus siblings and new pages when something splits or merges, and nothing else.
+ *  - Readers latch shared and crab: a child is latched before its parent is let go, and a scan latches the next leaf before it
+ *    lets go of the one it's on. While holding a latch a reader only ever tries for another one. If that fails the writer has it,
+ *    so the reader lets go of everything, waits for the page and starts over from the root (or right after the last key it saw).
+ *    Readers never wait while holding a latch, so the writer can't end up waiting on a reader that waits on it.
+ *  - The writer takes its latches in whatever order the tree leads it to, not in page order, and two statements can take the
+ *    same two pages the other way around. That can't deadlock: a waits-for cycle needs two threads that each wait while holding
+ *    a latch, but Table.writer lets only one writer in at a time, and readers never wait while holding one. ThreadSanitizer
+ *    doesn't see that and reports the writer's latches as a lock-order-inversion (TSAN_OPTIONS=detect_deadlocks=0 quiets it).
+ * A long scan only holds one leaf at a time, and only holds up a write that needs that leaf. Meta commands (.load, .export and
+ * friends) aren't covered and expect to have the database to themselves.
+ */
+
+// set on a thread while it runs a write statement against this pager
+__thread Pager* writing_pager = NULL;
+
+// the latch of page_num, making room for it first if it's the first page of its chunk to be latched
+PageLatch* page_latch(Pager* pager, u_int32_t page_num) {
+    u_int32_t chunk = page_num / LATCH_CHUNK_PAGES;
+    pthread_mutex_lock(&pager->latch);
+    if (chunk >= pager->num_latch_chunks) {
+        u_int32_t num_chunks = pager->num_latch_chunks * 2 > chunk ? pager->num_latch_chunks * 2 : chunk + 1;
+        pager->latch_chunks = realloc(pager->latch_chunks, num_chunks * sizeof(PageLatch*));
+        memset(pager->latch_chunks + pager->num_latch_chunks, 0, (num_chunks - pager->num_latch_chunks) * sizeof(PageLatch*));
+        pager->num_latch_chunks = num_chunks;
+    }
+    if (pager->latch_chunks[chunk] == NULL) {
+        // glibc lets readers in ahead of a waiting writer by default, and there is always some reader passing through the root.
+        // with writers first, a reader that finds a writer waiting backs off like it would if the writer had the page already
+        pthread_rwlockattr_t attributes;
+        pthread_rwlockattr_init(&attributes);
+        pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        PageLatch* latches = malloc(LATCH_CHUNK_PAGES * sizeof(PageLatch));
+        for (u_int32_t i = 0; i < LATCH_CHUNK_PAGES; i++) {
+            pthread_rwlock_init(&latches[i].lock, &attributes);
+            latches[i].write_latched = false;
+        }
+        pthread_rwlockattr_destroy(&attributes);
+        pager->latch_chunks[chunk] = latches;
+    }
+    PageLatch* latch = &pager->latch_chunks[chunk][page_num % LATCH_CHUNK_PAGES];
+    pthread_mutex_unlock(&pager->latch);
+    return latch;
 }
 
-u_int32_t get_node_max_key(void* node) {
-    switch (get_node_type(node)) {
-        case NODE_INTERNAL:
-            return *internal_node_key(node, *internal_node_num_keys(node) - 1);
-        case NODE_LEAF:
-            return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+// the writer's side. a page that is latched already stays that way until release_write_latches()
+void write_latch_page(Pager* pager, u_int32_t page_num) {
+    PageLatch* latch = page_latch(pager, page_num);
+    if (latch->write_latched) {
+        return;
+    }
+    pthread_rwlock_wrlock(&latch->lock);
+    latch->write_latched = true;
+    if (pager->num_write_latches == pager->write_latches_capacity) {
+        pager->write_latches_capacity = pager->write_latches_capacity == 0 ? 64 : pager->write_latches_capacity * 2;
+        pager->write_latches = realloc(pager->write_latches, pager->write_latches_capacity * sizeof(u_int32_t));
     }
+    pager->write_latches[pager->num_write_latches++] = page_num;
 }
 
-u_int32_t* node_parent(void* node) {
-    return node + PARENT_POINTER_OFFSET;
+void release_write_latches(Pager* pager) {
+    for (u_int32_t i = 0; i < pager->num_write_latches; i++) {
+        PageLatch* latch = page_latch(pager, pager->write_latches[i]);
+        latch->write_latched = false;
+        pthread_rwlock_unlock(&latch->lock);
+    }
+    pager->num_write_latches = 0;
 }
 
-// helper for the helper for leaf_node_insert() lol. we already allocated the right child node and moved the upper half of its parent into it.
-// now we just gotta allocate the left child node.
-void create_new_root(Table* table, u_int32_t right_child_page_num) {
-    void* root = get_page(table->pager, table->root_page_num);
-    void* right_child = get_page(table->pager, right_child_page_num);
-    u_int32_t left_child_page_num = get_unused_page_num(table->pager);
-    void* left_child = get_page(table->pager, left_child_page_num);
+// the readers' side. outside concurrent mode, and on the writer's own thread, these do nothing
+bool reads_latched(Pager* pager) {
+    return pager->concurrent && writing_pager != pager;
+}
 
-    // old root copied to left child
-    memcpy(left_child, root, PAGE_SIZE);
-    set_node_root(left_child, false);
+void latch_page(Pager* pager, u_int32_t page_num) {
+    if (reads_latched(pager)) {
+        pthread_rwlock_rdlock(&page_latch(pager, page_num)->lock);
+    }
+}
 
-    // root page is new internal node. it has a single key and two children
-    initialize_internal_node(root);
-    set_node_root(root, true);
-    *internal_node_num_keys(root) = 1;
-    *internal_node_child(root, 0) = left_child_page_num;
-    u_int32_t left_child_max_key = get_node_max_key(left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
-    *node_parent(left_child) = table->root_page_num;
-    *node_parent(right_child) = table->root_page_num;
+bool try_latch_page(Pager* pager, u_int32_t page_num) {
+    return !reads_latched(pager) || pthread_rwlock_tryrdlock(&page_latch(pager, page_num)->lock) == 0;
 }
 
-void update_internal_node_key(void* node, u_int32_t old_key, u_int32_t new_key) {
-    u_int32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+void unlatch_page(Pager* pager, u_int32_t page_num) {
+    if (reads_latched(pager)) {
+        pthread_rwlock_unlock(&page_latch(pager, page_num)->lock);
+    }
 }
 
-// helper function for leaf_node_insert(); if no space is left on the leaf node, it splits it until an upper and lower node
-void leaf_node_split_and_insert(Cursor* cursor, u_int32_t key, Row* value) {
-    /**
-     * Splitting the node into two
-     * */
-    void* old_node = get_page(cursor->table->pager, cursor->page_num);
-    u_int32_t old_max = get_node_max_key(old_node);
-    u_int32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    void* new_node = get_page(cursor->table->pager, new_page_num);
-    initialize_leaf_node(new_node);
-    *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
+// returns once the writer is done with page_num. the caller can't be holding any latches
+void wait_for_page(Pager* pager, u_int32_t page_num) {
+    latch_page(pager, page_num);
+    unlatch_page(pager, page_num);
+}
 
-    /**
-     * Divide all existing keys (including the one we just made) evenly left and right.
-     * Start from the right and move keys to correct positions
-     */
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-        void* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
-            destination_node = new_node;
-        } else {
-            destination_node = old_node;
+// crabbing one level down: the child is latched before the parent is let go, so the pointer that led to it can't go stale in
+// between. if the child is busy the parent is let go anyway, and once the child is free again false says to start over
+bool latch_child(Pager* pager, u_int32_t parent_page_num, u_int32_t child_page_num) {
+    bool latched = try_latch_page(pager, child_page_num);
+    unlatch_page(pager, parent_page_num);
+    if (!latched) {
+        wait_for_page(pager, child_page_num);
+    }
+    return latched;
+}
+
+// the threads of a parallel scan race for the pool's bookkeeping, and so do the threads of concurrent mode. only then are pins
+// taken and released under the pager's latch. everything else runs on one thread and doesn't pay for it
+void* get_page(Pager* pager, u_int32_t page_num) {
+    if (!pager->shared) {
+        return pager_pin_page(pager, page_num);
+    }
+    if (writing_pager == pager) {
+        write_latch_page(pager, page_num);
+    }
+    pthread_mutex_lock(&pager->latch);
+    void* page = pager_pin_page(pager, page_num);
+    pthread_mutex_unlock(&pager->latch);
+    return page;
+}
+
+// releases a pin taken by get_page(). once every pin is gone the frame becomes a candidate for eviction
+void unpin_page(Pager* pager, u_int32_t page_num) {
+    if (pager->use_mmap) {
+        // mapped pages never get evicted, so there is nothing to release
+        return;
+    }
+    if (pager->shared) {
+        pthread_mutex_lock(&pager->latch);
+    }
+    int32_t frame_index = pager_lookup(pager, page_num);
+    if (frame_index == NO_FRAME || pager->frames[frame_index].pin_count == 0) {
+        printf("Tried to unpin page %d which is not pinned\n", page_num);
+        exit(EXIT_FAILURE);
+    }
+    pager->frames[frame_index].pin_count -= 1;
+    if (pager->shared) {
+        pthread_mutex_unlock(&pager->latch);
+    }
+}
+
+// flags a cached page as modified so it gets written back on eviction. callers must still hold a pin on the page
+void mark_page_dirty(Pager* pager, u_int32_t page_num) {
+    bool was_dirty, was_uncommitted;
+    Frame* frame = NULL;
+    if (pager->shared) {
+        pthread_mutex_lock(&pager->latch);
+    }
+    if (pager->use_mmap) {
+        was_dirty = pager->page_flags[page_num] & PAGE_FLAG_DIRTY;
+        was_uncommitted = pager->page_flags[page_num] & PAGE_FLAG_UNCOMMITTED;
+        pager->page_flags[page_num] |= PAGE_FLAG_DIRTY;
+    } else {
+        int32_t frame_index = pager_lookup(pager, page_num);
+        if (frame_index == NO_FRAME) {
+            printf("Tried to mark uncached page %d dirty\n", page_num);
+            exit(EXIT_FAILURE);
         }
-        u_int32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        void* destination = leaf_node_cell(destination_node, index_within_node);
+        frame = &pager->frames[frame_index];
+        was_dirty = frame->dirty;
+        was_uncommitted = frame->uncommitted;
+        frame->dirty = true;
+    }
+    if (!was_dirty) {
+        pager->num_dirty += 1;
+    }
 
-        if (i == cursor->cell_num) {
-            serialize_row(value, leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
-        } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+    // remember the page so the statement's commit logs it
+    Wal* wal = pager->wal;
+    if (wal != NULL && !wal->replaying && !pager->bulk_loading && !was_uncommitted) {
+        if (pager->use_mmap) {
+            pager->page_flags[page_num] |= PAGE_FLAG_UNCOMMITTED;
         } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            frame->uncommitted = true;
+        }
+        if (wal->num_txn_pages == wal->txn_pages_capacity) {
+            wal->txn_pages_capacity *= 2;
+            wal->txn_pages = realloc(wal->txn_pages, wal->txn_pages_capacity * sizeof(u_int32_t));
         }
+        wal->txn_pages[wal->num_txn_pages++] = page_num;
     }
+    if (pager->shared) {
+        pthread_mutex_unlock(&pager->latch);
+    }
+}
 
-    /**
-     * Update cell count in both leaf node headers
-     */
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+// the file is at least as long as a write that just ended at offset + length
+void pager_note_write(Pager* pager, off_t offset, size_t length) {
+    if (pager->file_length < offset + (off_t)length) {
+        pager->file_length = offset + length;
+    }
+}
 
-    /**
-     * Update nodes' parent
-     */
-    if (is_node_root(old_node)) {
-        return create_new_root(cursor->table, new_page_num);
+// a page that a checkpoint is about to write, wherever it happens to live (a frame or the mapping)
+typedef struct {
+    u_int32_t page_num;
+    void* data;
+} DirtyPage;
+
+int compare_dirty_page_nums(const void* a, const void* b) {
+    u_int32_t page_a = ((DirtyPage*)a)->page_num;
+    u_int32_t page_b = ((DirtyPage*)b)->page_num;
+    return (page_a > page_b) - (page_a < page_b);
+}
+
+// copies page images out of the log into the database file: all the reads at once, then all the writes. pages has room for count
+// of them
+void pager_copy_from_wal(Pager* pager, u_int32_t* page_nums, off_t* wal_offsets, u_int32_t count, void* pages) {
+    struct iovec iovs[PREFETCH_MAX_PAGES];
+    PageIo ios[PREFETCH_MAX_PAGES];
+    for (u_int32_t write = 0; write <= 1; write++) {
+        for (u_int32_t i = 0; i < count; i++) {
+            iovs[i].iov_base = pages + (size_t)i * PAGE_SIZE;
+            iovs[i].iov_len = PAGE_SIZE;
+            ios[i].write = write;
+            ios[i].fd = write ? pager->file_descriptor : pager->wal->file_descriptor;
+            ios[i].iov = &iovs[i];
+            ios[i].iov_count = 1;
+            ios[i].offset = write ? page_offset(page_nums[i]) : wal_offsets[i];
+        }
+        pager_io(pager, ios, count);
+    }
+    for (u_int32_t i = 0; i < count; i++) {
+        pager_note_write(pager, page_offset(page_nums[i]), PAGE_SIZE);
+    }
+}
+
+// writes every dirty page back to the file and syncs it. pages are sorted by page number so that runs of neighbouring pages
+// go out as one big vectored write instead of a seek + write per page. clean pages are never touched, so this is cheap when little changed
+u_int32_t pager_checkpoint(Pager* pager) {
+    u_int32_t num_written = 0;
+
+    // pages whose newest image only exists in the log get copied over first, a batch at a time. anything still in the pool is
+    // newer and gets written below
+    Wal* wal = pager->wal;
+    if (wal != NULL && wal->index_count > 0) {
+        void* pages = malloc((size_t)PREFETCH_MAX_PAGES * PAGE_SIZE);
+        u_int32_t page_nums[PREFETCH_MAX_PAGES];
+        off_t wal_offsets[PREFETCH_MAX_PAGES];
+        u_int32_t num_pages = 0;
+        for (u_int32_t i = 0; i < wal->index_capacity; i++) {
+            WalIndexEntry* entry = &wal->index[i];
+            if (entry->offset < 0 || pager_lookup(pager, entry->page_num) != NO_FRAME) {
+                continue;
+            }
+            page_nums[num_pages] = entry->page_num;
+            wal_offsets[num_pages] = entry->offset;
+            num_pages++;
+            if (num_pages == PREFETCH_MAX_PAGES) {
+                pager_copy_from_wal(pager, page_nums, wal_offsets, num_pages, pages);
+                num_written += num_pages;
+                num_pages = 0;
+            }
+        }
+        pager_copy_from_wal(pager, page_nums, wal_offsets, num_pages, pages);
+        num_written += num_pages;
+        free(pages);
+    }
+
+    DirtyPage* dirty_pages = malloc((pager->num_dirty + 1) * sizeof(DirtyPage));
+    u_int32_t num_dirty_pages = 0;
+    if (pager->use_mmap) {
+        // walking the flags in order already gives us sorted page numbers
+        for (u_int32_t page_num = 0; page_num < pager->mapped_pages; page_num++) {
+            if (pager->page_flags[page_num] & PAGE_FLAG_DIRTY) {
+                pager->page_flags[page_num] &= ~PAGE_FLAG_DIRTY;
+                dirty_pages[num_dirty_pages].page_num = page_num;
+                dirty_pages[num_dirty_pages].data = pager->map + page_offset(page_num);
+                num_dirty_pages++;
+            }
+        }
     } else {
-        u_int32_t parent_page_num = *node_parent(old_node);
-        u_int32_t new_max = get_node_max_key(old_node);
-        void* parent = get_page(cursor->table->pager, parent_page_num);
+        for (u_int32_t i = 0; i < pager->num_frames; i++) {
+            Frame* frame = &pager->frames[i];
+            if (frame->in_use && frame->dirty) {
+                frame->dirty = false;
+                dirty_pages[num_dirty_pages].page_num = frame->page_num;
+                dirty_pages[num_dirty_pages].data = frame->data;
+                num_dirty_pages++;
+            }
+        }
+        qsort(dirty_pages, num_dirty_pages, sizeof(DirtyPage), compare_dirty_page_nums);
+    }
+
+    // every run of neighbouring pages becomes one vectored write, and with io_uring the runs all go to the kernel together
+    struct iovec* iovs = malloc((num_dirty_pages + 1) * sizeof(struct iovec));
+    PageIo* runs = malloc((num_dirty_pages + 1) * sizeof(PageIo));
+    u_int32_t* run_lengths = malloc((num_dirty_pages + 1) * sizeof(u_int32_t));
+    u_int32_t num_runs = 0;
+    u_int32_t i = 0;
+    while (i < num_dirty_pages) {
+        u_int32_t run_start = dirty_pages[i].page_num;
+        u_int32_t run_length = 0;
+        runs[num_runs].write = true;
+        runs[num_runs].fd = pager->file_descriptor;
+        runs[num_runs].iov = &iovs[i];
+        runs[num_runs].offset = page_offset(run_start);
+        while (i < num_dirty_pages && run_length < CHECKPOINT_MAX_IOVECS
+               && dirty_pages[i].page_num == run_start + run_length) {
+            iovs[i].iov_base = dirty_pages[i].data;
+            iovs[i].iov_len = PAGE_SIZE;
+            run_length++;
+            i++;
+        }
+        runs[num_runs].iov_count = run_length;
+        run_lengths[num_runs++] = run_length;
+    }
+    pager_io(pager, runs, num_runs);
+
+    // pager_io() moves the iovecs along as it goes, so the runs are gone through again by their lengths
+    for (u_int32_t run = 0, first = 0; run < num_runs; first += run_lengths[run], run++) {
+        u_int32_t run_start = dirty_pages[first].page_num;
+        pager_note_write(pager, page_offset(run_start), (size_t)run_lengths[run] * PAGE_SIZE);
+        // the file has these pages now, so drop our private copies and let the mapping share the page cache again
+        if (pager->use_mmap) {
+            madvise(pager->map + page_offset(run_start), (size_t)run_lengths[run] * PAGE_SIZE, MADV_DONTNEED);
+        }
+    }
+    num_written += num_dirty_pages;
+    free(run_lengths);
+    free(runs);
+    free(iovs);
+    free(dirty_pages);
+
+    if (num_written > 0 && fdatasync(pager->file_descriptor) == -1) {
+        printf("Error syncing db file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    // everything the log describes is in the database file now
+    if (pager->wal != NULL && pager->wal->file_length > 0) {
+        wal_truncate(pager->wal);
+    }
+    pager->num_dirty = 0;
+    pager->last_checkpoint = time(NULL);
+    return num_written;
+}
+
+// called between statements. checkpoints once enough pages are dirty or enough time has passed since the last one
+void pager_maybe_checkpoint(Pager* pager) {
+    if (pager->num_dirty == 0) {
+        return;
+    }
+    bool too_many_dirty = pager->checkpoint_pages > 0 && pager->num_dirty >= pager->checkpoint_pages;
+    bool too_long_ago = pager->checkpoint_seconds > 0
+        && time(NULL) - pager->last_checkpoint >= pager->checkpoint_seconds;
+    bool wal_too_big = pager->wal != NULL && pager->wal->file_length >= WAL_CHECKPOINT_BYTES;
+    if (too_many_dirty || too_long_ago || wal_too_big) {
+        pager_checkpoint(pager);
+    }
+}
 
-        update_internal_node_key(parent, old_max, new_max);
-        internal_node_insert(cursor->table, parent_page_num);
+// commits the running statement. the image of every page it modified plus a commit record go to the end of the log in one
+// sequential write. only every group_size-th commit pays for an fdatasync()
+void pager_commit(Pager* pager) {
+    Wal* wal = pager->wal;
+    if (wal == NULL || wal->num_txn_pages == 0) {
         return;
     }
+
+    size_t needed = (wal->num_txn_pages + 1) * sizeof(WalRecordHeader) + (size_t)wal->num_txn_pages * PAGE_SIZE;
+    if (needed > wal->buffer_capacity) {
+        wal->buffer_capacity = needed;
+        wal->buffer = realloc(wal->buffer, needed);
+    }
+
+    size_t buffer_length = 0;
+    for (u_int32_t i = 0; i < wal->num_txn_pages; i++) {
+        u_int32_t page_num = wal->txn_pages[i];
+        void* data;
+        if (pager->use_mmap) {
+            data = pager->map + page_offset(page_num);
+            pager->page_flags[page_num] &= ~PAGE_FLAG_UNCOMMITTED;
+        } else {
+            // pages that were stolen into the log already have their newest image there. a page can also show up twice
+            // when it was modified again after coming back, and it only needs logging once
+            int32_t frame_index = pager_lookup(pager, page_num);
+            if (frame_index == NO_FRAME || !pager->frames[frame_index].uncommitted) {
+                continue;
+            }
+            data = pager->frames[frame_index].data;
+            pager->frames[frame_index].uncommitted = false;
+        }
+        wal_buffer_record(wal, &buffer_length, WAL_RECORD_PAGE, page_num, data, PAGE_SIZE);
+    }
+    wal_buffer_record(wal, &buffer_length, WAL_RECORD_COMMIT, 0, NULL, 0);
+    wal->num_txn_pages = 0;
+
+    ssize_t bytes_written = pwrite(wal->file_descriptor, wal->buffer, buffer_length, wal->file_length);
+    if (bytes_written != (ssize_t)buffer_length) {
+        printf("Error writing wal: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    wal->file_length += buffer_length;
+    wal->unsynced_commits += 1;
+    if (wal->unsynced_commits >= wal->group_size) {
+        wal_sync(wal);
+    }
 }
 
-// inserts a node into the B-tree
-void leaf_node_insert(Cursor* cursor, u_int32_t key, Row* value) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
+// reads the record at offset into header/payload. returns false at the end of the log or at the first record that is torn,
+// fails its checksum or goes backwards in lsn (leftovers from before a truncate)
+bool wal_read_record(Wal* wal, off_t offset, u_int64_t min_lsn, WalRecordHeader* header, void* payload) {
+    if (pread(wal->file_descriptor, header, sizeof(WalRecordHeader), offset) != sizeof(WalRecordHeader)) {
+        return false;
+    }
+    if (header->payload_size > PAGE_SIZE || header->lsn < min_lsn) {
+        return false;
+    }
+    if (header->payload_size > 0
+        && pread(wal->file_descriptor, payload, header->payload_size, offset + sizeof(WalRecordHeader)) != header->payload_size) {
+        return false;
+    }
+    return header->checksum == wal_record_checksum(header, payload);
+}
+
+// redo recovery. the first pass finds where the last complete commit ends, the second copies every page image up to that
+// point into the pager. anything after it belongs to a statement that never committed and is ignored
+void wal_replay(Pager* pager) {
+    Wal* wal = pager->wal;
+    WalRecordHeader header;
+    void* payload = malloc(PAGE_SIZE);
+
+    off_t offset = 0;
+    off_t committed_length = 0;
+    u_int64_t lsn = 0;
+    while (wal_read_record(wal, offset, lsn, &header, payload)) {
+        offset += sizeof(WalRecordHeader) + header.payload_size;
+        lsn = header.lsn + 1;
+        if (header.type == WAL_RECORD_COMMIT) {
+            committed_length = offset;
+            wal->next_lsn = lsn;
+        }
+    }
+
+    wal->replaying = true;
+    offset = 0;
+    while (offset < committed_length) {
+        wal_read_record(wal, offset, 0, &header, payload);
+        offset += sizeof(WalRecordHeader) + header.payload_size;
+        if (header.type == WAL_RECORD_PAGE) {
+            void* page = get_page(pager, header.page_num);
+            memcpy(page, payload, PAGE_SIZE);
+            mark_page_dirty(pager, header.page_num);
+            unpin_page(pager, header.page_num);
+        }
+    }
+    wal->replaying = false;
+    free(payload);
+
+    // write the recovered pages into the database file and start over with an empty log
+    pager_checkpoint(pager);
+}
+
+// opens (or creates) the log next to the database file and replays whatever a previous run left behind
+void wal_open(Pager* pager, const char* filename, u_int32_t group_size) {
+    char* wal_filename = malloc(strlen(filename) + strlen(WAL_SUFFIX) + 1);
+    strcpy(wal_filename, filename);
+    strcat(wal_filename, WAL_SUFFIX);
+    int fd = open(wal_filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        printf("Unable to open wal file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Wal* wal = malloc(sizeof(Wal));
+    wal->filename = wal_filename;
+    wal->file_descriptor = fd;
+    wal->file_length = lseek(fd, 0, SEEK_END);
+    wal->next_lsn = 1;
+    wal->group_size = group_size;
+    wal->unsynced_commits = 0;
+    wal->txn_pages_capacity = 16;
+    wal->txn_pages = malloc(wal->txn_pages_capacity * sizeof(u_int32_t));
+    wal->num_txn_pages = 0;
+    wal->buffer = NULL;
+    wal->buffer_capacity = 0;
+    wal->index = NULL;
+    wal->index_capacity = 0;
+    wal->index_count = 0;
+    wal->replaying = false;
+    pager->wal = wal;
+
+    if (wal->file_length > 0) {
+        wal_replay(pager);
+    }
+}
+
+// after the final checkpoint the log is empty, so a clean shutdown leaves no log file behind
+void wal_close(Wal* wal) {
+    close(wal->file_descriptor);
+    unlink(wal->filename);
+    free(wal->filename);
+    free(wal->txn_pages);
+    free(wal->buffer);
+    free(wal->index);
+    free(wal);
+}
+
+// getter/setter for root node
+bool is_node_root(void* node) {
+    u_int8_t value = *((u_int8_t*)(node + IS_ROOT_OFFSET));
+    return (bool)value;
+}
+
+void set_node_root(void* node, bool is_root) {
+    u_int8_t value = is_root;
+    *((u_int8_t*)(node + IS_ROOT_OFFSET)) = value;
+}
+
+u_int32_t* leaf_node_next_leaf(void* node) {
+    return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+// some pointer arithmetic functions that return pointers to values, so the functions can be used both as getters and setters
+u_int32_t* leaf_node_num_cells(void* node) {
+    return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+u_int32_t* leaf_node_keys(void* node) {
+    return node + LEAF_NODE_KEYS_OFFSET;
+}
+
+u_int32_t* leaf_node_key(void* node, u_int32_t cell_num) {
+    return leaf_node_keys(node) + cell_num;
+}
+
+// the row offsets array starts right after the last key, so it moves whenever a cell is added or removed
+u_int16_t* leaf_node_row_offsets(void* node) {
+    return node + LEAF_NODE_KEYS_OFFSET + *leaf_node_num_cells(node) * LEAF_NODE_KEY_SIZE;
+}
+
+u_int32_t* leaf_node_content_start(void* node) {
+    return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+u_int32_t* leaf_node_fragmented(void* node) {
+    return node + LEAF_NODE_FRAGMENTED_OFFSET;
+}
+
+void* leaf_node_value(void* node, u_int32_t cell_num) {
+    return node + leaf_node_row_offsets(node)[cell_num];
+}
+
+// size of a row in its compact encoding, read from the length bytes in front of each string
+u_int32_t encoded_row_size(void* record) {
+    u_int8_t username_length = *(u_int8_t*)(record + ID_SIZE);
+    u_int8_t email_length = *(u_int8_t*)(record + ID_SIZE + 1 + username_length);
+    return ID_SIZE + 1 + username_length + 1 + email_length;
+}
+
+// bytes between the end of the slot directory and the first row. a new cell needs room for its slot and its row in here
+u_int32_t leaf_node_gap(void* node) {
+    u_int32_t slots_end = LEAF_NODE_KEYS_OFFSET + *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE;
+    return *leaf_node_content_start(node) - slots_end;
+}
+
+// every row slides down against the end of the page, which turns fragmented bytes back into gap
+void leaf_node_compact(void* node) {
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
 
     u_int32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
-        leaf_node_split_and_insert(cursor, key, value);
-        return;
+    u_int16_t* row_offsets = leaf_node_row_offsets(node);
+    u_int32_t content_start = PAGE_SIZE;
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        void* record = copy + row_offsets[i];
+        u_int32_t size = encoded_row_size(record);
+        content_start -= size;
+        memcpy(node + content_start, record, size);
+        row_offsets[i] = content_start;
+    }
+    *leaf_node_content_start(node) = content_start;
+    *leaf_node_fragmented(node) = 0;
+}
+
+// puts a cell with an already encoded row at cell_num, shifting the cells after it. returns false if the leaf can't fit it
+bool leaf_node_insert_record(void* node, u_int32_t cell_num, u_int32_t key, void* record, u_int32_t size) {
+    u_int32_t needed = LEAF_NODE_SLOT_SIZE + size;
+    if (leaf_node_gap(node) < needed) {
+        if (leaf_node_gap(node) + *leaf_node_fragmented(node) < needed) {
+            return false;
+        }
+        leaf_node_compact(node);
     }
 
-    if (cursor->cell_num < num_cells) {
-        for (u_int32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+    /**
+     * Make room in the slot directory. The row offsets array moves up by one key, and by one more offset after cell_num.
+     * The tail goes first since it moves the furthest, then the head, then the keys can grow into the space that freed up.
+     */
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    u_int16_t* old_offsets = leaf_node_row_offsets(node);
+    u_int16_t* new_offsets = (void*)old_offsets + LEAF_NODE_KEY_SIZE;
+    memmove(new_offsets + cell_num + 1, old_offsets + cell_num, (num_cells - cell_num) * LEAF_NODE_ROW_OFFSET_SIZE);
+    memmove(new_offsets, old_offsets, cell_num * LEAF_NODE_ROW_OFFSET_SIZE);
+    u_int32_t* keys = leaf_node_keys(node);
+    memmove(keys + cell_num + 1, keys + cell_num, (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+
+    u_int32_t content_start = *leaf_node_content_start(node) - size;
+    memcpy(node + content_start, record, size);
+    *leaf_node_content_start(node) = content_start;
+    keys[cell_num] = key;
+    new_offsets[cell_num] = content_start;
+    *leaf_node_num_cells(node) = num_cells + 1;
+    return true;
+}
+
+void set_node_type(void* node, NodeType type) {
+    u_int8_t value = type == NODE_LEAF ? NODE_TYPE_BYTE_LEAF : NODE_TYPE_BYTE_INTERNAL;
+    *((u_int8_t*)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+void initialize_leaf_node(void* node) {
+    set_node_type(node, NODE_LEAF);
+    set_node_root(node, false);
+    *leaf_node_num_cells(node) = 0;
+    *leaf_node_next_leaf(node) = 0; // 0 means there is no sibling and thus this node is the last child of its parent
+    *leaf_node_content_start(node) = PAGE_SIZE;
+    *leaf_node_fragmented(node) = 0;
+}
+
+void serialize_row_fields(u_int32_t id, const char* username, const char* email, void* destination, u_int32_t* size);
+
+/**
+ * Rewrites a leaf in one of the older fixed size layouts as a slotted page. Rows in those layouts were padded to ROW_SIZE,
+ * so their compact encoding always fits. The header fields they share (root flag, parent, cell count, next leaf) stay put.
+ */
+void upgrade_legacy_leaf(void* node) {
+    u_int8_t type = *((u_int8_t*)(node + NODE_TYPE_OFFSET));
+    if (type != NODE_TYPE_BYTE_LEGACY_LEAF && type != NODE_TYPE_BYTE_PACKED_LEAF) {
+        return;
+    }
+
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    u_int32_t num_cells = *leaf_node_num_cells(copy);
+
+    bool is_root = is_node_root(node);
+    initialize_leaf_node(node);
+    set_node_root(node, is_root);
+    *leaf_node_next_leaf(node) = *leaf_node_next_leaf(copy);
+
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        void* key;
+        void* fixed_row;
+        if (type == NODE_TYPE_BYTE_LEGACY_LEAF) {
+            key = copy + LEGACY_LEAF_CELLS_OFFSET + i * LEGACY_LEAF_CELL_SIZE;
+            fixed_row = key + sizeof(u_int32_t);
+        } else {
+            key = copy + PACKED_LEAF_KEYS_OFFSET + i * sizeof(u_int32_t);
+            fixed_row = copy + PACKED_LEAF_KEYS_OFFSET + PACKED_LEAF_MAX_CELLS * sizeof(u_int32_t) + i * ROW_SIZE;
+        }
+
+        u_int8_t record[ROW_SIZE];
+        u_int32_t size;
+        serialize_row_fields(*(u_int32_t*)fixed_row, fixed_row + ID_SIZE, fixed_row + ID_SIZE + USERNAME_SIZE, record, &size);
+        leaf_node_insert_record(node, i, *(u_int32_t*)key, record, size);
+    }
+}
+
+void initialize_internal_node(void* node) {
+    set_node_type(node, NODE_INTERNAL);
+    set_node_root(node, false);
+    *internal_node_num_keys(node) = 0;
+}
+
+NodeType get_node_type(void* node) {
+    u_int8_t value = *((u_int8_t*)(node + NODE_TYPE_OFFSET));
+    return value == NODE_TYPE_BYTE_INTERNAL ? NODE_INTERNAL : NODE_LEAF;
+}
+
+/**
+ * Counts how many of the sorted keys are smaller than key, which is the index key sits at (or would be inserted at).
+ * The vector versions compare 8 (AVX2) or 4 (SSE2) keys at once. There is no unsigned compare, so flipping the sign bit of both
+ * sides makes the signed one order them correctly, and movemask turns the result into one bit per key. Since the keys are
+ * sorted, the first vector that isn't all smaller ends the search.
+ */
+u_int32_t count_keys_below_scalar(const u_int32_t* keys, u_int32_t num_keys, u_int32_t key) {
+    u_int32_t i = 0;
+    while (i < num_keys && keys[i] < key) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+u_int32_t count_keys_below_avx2(const u_int32_t* keys, u_int32_t num_keys, u_int32_t key) {
+    const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+    const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+    u_int32_t i = 0;
+    for (; i + 8 <= num_keys; i += 8) {
+        __m256i chunk = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(keys + i)), sign);
+        u_int32_t below = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, chunk)));
+        if (below != 0xFF) {
+            return i + __builtin_popcount(below);
+        }
+    }
+    return i + count_keys_below_scalar(keys + i, num_keys - i, key);
+}
+
+__attribute__((target("sse2")))
+u_int32_t count_keys_below_sse2(const u_int32_t* keys, u_int32_t num_keys, u_int32_t key) {
+    const __m128i sign = _mm_set1_epi32(INT32_MIN);
+    const __m128i needle = _mm_xor_si128(_mm_set1_epi32(key), sign);
+    u_int32_t i = 0;
+    for (; i + 4 <= num_keys; i += 4) {
+        __m128i chunk = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(keys + i)), sign);
+        u_int32_t below = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, chunk)));
+        if (below != 0xF) {
+            return i + __builtin_popcount(below);
+        }
+    }
+    return i + count_keys_below_scalar(keys + i, num_keys - i, key);
+}
+#endif
+
+// every key search goes through this, so the version is picked once by choose_count_keys_below() instead of asking the cpu
+// on each call
+u_int32_t (*count_keys_below)(const u_int32_t* keys, u_int32_t num_keys, u_int32_t key) = count_keys_below_scalar;
+
+void choose_count_keys_below() {
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        count_keys_below = count_keys_below_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        count_keys_below = count_keys_below_sse2;
+    }
+#endif
+}
+
+// index of the first cell whose key is >= key. a binary search narrows big leaves down to a window of keys that fits in a
+// cache line or so, and the vector compare finishes from there
+u_int32_t leaf_node_lower_bound(void* node, u_int32_t key) {
+    u_int32_t* keys = leaf_node_keys(node);
+    u_int32_t min_index = 0;
+    u_int32_t one_past_max_index = *leaf_node_num_cells(node);
+
+    while (one_past_max_index - min_index > LEAF_NODE_SIMD_WINDOW) {
+        u_int32_t index = (min_index + one_past_max_index) / 2;
+        if (keys[index] < key) {
+            min_index = index + 1;
+        } else {
+            one_past_max_index = index;
+        }
+    }
+    return min_index + count_keys_below(keys + min_index, one_past_max_index - min_index, key);
+}
+
+// binary search for the index of the child that should contain the given key. keys are the max of their child, so that's the
+// first key >= the one we want, or the right child if there is none
+u_int32_t internal_node_find_child(void* node, u_int32_t key) {
+    u_int32_t num_keys = *internal_node_num_keys(node);
+
+    u_int32_t min_index = 0;
+    u_int32_t max_index = num_keys; // there is one more child than key
+
+    while (min_index != max_index) {
+        u_int32_t index = (min_index + max_index) / 2;
+        u_int32_t key_to_right = *internal_node_key(node, index);
+        if (key_to_right >= key) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+
+    return min_index;
+}
+
+// search a leaf node for the key. the returned cursor keeps the leaf pinned (and a reader's latch on it) until close_cursor()
+Cursor* leaf_node_find(Table* table, u_int32_t page_num, u_int32_t key) {
+    void* node = get_page(table->pager, page_num);
+
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->end_of_table = false;
+    cursor->cell_num = leaf_node_lower_bound(node, key);
+    memset(&cursor->readahead, 0, sizeof(Readahead));
+
+    return cursor;
+}
+
+Cursor* table_find(Table* table, u_int32_t key);
+
+// page_num is latched by the caller. a reader crabs into the child, and starts over from the root if it was busy
+Cursor* internal_node_find(Table* table, u_int32_t page_num, u_int32_t key) {
+    void* node = get_page(table->pager, page_num);
+    u_int32_t child_index = internal_node_find_child(node, key);
+
+    u_int32_t child_num = *internal_node_child(node, child_index);
+    unpin_page(table->pager, page_num);
+    if (!latch_child(table->pager, page_num, child_num)) {
+        return table_find(table, key);
+    }
+
+    void* child = get_page(table->pager, child_num);
+    NodeType child_type = get_node_type(child);
+    unpin_page(table->pager, child_num);
+    switch (child_type) {
+        case NODE_LEAF:
+            return leaf_node_find(table, child_num, key);
+        case NODE_INTERNAL:
+            return internal_node_find(table, child_num, key);
+        default:
+            printf("Unknown node type %d on page %d\n", child_type, child_num);
+            exit(EXIT_FAILURE);
+    }
+}
+
+// returns the position of the given key in the tree. if key isn't present, return the position where it should be inserted
+Cursor* table_find(Table* table, u_int32_t key) {
+    u_int32_t root_page_num = table->root_page_num;
+    latch_page(table->pager, root_page_num);
+    void* root_node = get_page(table->pager, root_page_num);
+    NodeType root_type = get_node_type(root_node);
+    unpin_page(table->pager, root_page_num);
+
+    if (root_type == NODE_LEAF) {
+        return leaf_node_find(table, root_page_num, key);
+    } else {
+        return internal_node_find(table, root_page_num, key);
+    }
+}
+
+/**
+ * Where an insert of key goes. Ids mostly grow, so most inserts land past the last key of the last leaf, and that leaf is
+ * remembered so they don't have to walk down from the root each time. The page number is only a hint: pages get merged,
+ * freed and reused, so it's trusted only while the page still is a table leaf at the end of the chain, and key is past its
+ * last key. Anything else goes through table_find(), which also tells us the new last leaf when it lands on it.
+ */
+Cursor* table_find_insert(Table* table, u_int32_t key) {
+    Pager* pager = table->pager;
+    u_int32_t page_num = table->rightmost_leaf;
+    if (page_num != 0 && page_num < pager->num_pages) {
+        latch_page(pager, page_num);
+        void* node = get_page(pager, page_num);
+        u_int32_t num_cells = *leaf_node_num_cells(node);
+        if (*((u_int8_t*)(node + NODE_TYPE_OFFSET)) == NODE_TYPE_BYTE_LEAF && *leaf_node_next_leaf(node) == 0 &&
+            num_cells > 0 && key > *leaf_node_key(node, num_cells - 1)) {
+            // the pin taken above stays with the cursor, like the one leaf_node_find() takes
+            Cursor* cursor = malloc(sizeof(Cursor));
+            cursor->table = table;
+            cursor->page_num = page_num;
+            cursor->cell_num = num_cells;
+            cursor->end_of_table = false;
+            memset(&cursor->readahead, 0, sizeof(Readahead));
+            return cursor;
+        }
+        unpin_page(pager, page_num);
+        unlatch_page(pager, page_num);
+    }
+
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page(pager, cursor->page_num);
+    if (*leaf_node_next_leaf(node) == 0) {
+        table->rightmost_leaf = cursor->page_num;
+    }
+    unpin_page(pager, cursor->page_num);
+    return cursor;
+}
+
+// releases the cursor along with the pin (and latch) it holds on its current leaf
+void close_cursor(Cursor* cursor) {
+    unpin_page(cursor->table->pager, cursor->page_num);
+    unlatch_page(cursor->table->pager, cursor->page_num);
+    free(cursor);
+}
+
+Cursor* table_seek(Table* table, u_int32_t key);
+u_int32_t* node_parent(void* node);
+
+// walks the subtree under page_num, which has levels internal levels, from left to right starting at key. the leaves that
+// only hold bigger keys than key are added to page_nums, or all of its leaves if whole is set
+void collect_leaves_after(Pager* pager, u_int32_t page_num, u_int32_t levels, u_int32_t key, bool whole,
+                          u_int32_t* page_nums, u_int32_t* count, u_int32_t max) {
+    void* node = get_page(pager, page_num);
+    u_int32_t num_keys = *internal_node_num_keys(node);
+    u_int32_t first = whole ? 0 : internal_node_find_child(node, key);
+    unpin_page(pager, page_num);
+    for (u_int32_t i = first; i <= num_keys && *count < max; i++) {
+        node = get_page(pager, page_num);
+        u_int32_t child_page_num = *internal_node_child(node, i);
+        unpin_page(pager, page_num);
+        bool child_whole = whole || i > first;
+        if (levels > 1) {
+            collect_leaves_after(pager, child_page_num, levels - 1, key, child_whole, page_nums, count, max);
+        } else if (child_whole) {
+            page_nums[(*count)++] = child_page_num;
+        }
+    }
+}
+
+// the page numbers of up to max leaves that come after leaf, in key order. they're read off the internal nodes, which are
+// nearly always cached, without touching the leaves themselves. leaf has to be pinned
+u_int32_t collect_next_leaves(Pager* pager, void* leaf, u_int32_t* page_nums, u_int32_t max) {
+    u_int32_t num_cells = *leaf_node_num_cells(leaf);
+    if (is_node_root(leaf) || num_cells == 0) {
+        return 0;
+    }
+    // the parent links lead up to the root, and say how many internal levels there are on the way
+    u_int32_t levels = 0;
+    u_int32_t page_num = *node_parent(leaf);
+    while (true) {
+        levels++;
+        void* node = get_page(pager, page_num);
+        bool root = is_node_root(node);
+        u_int32_t parent_page_num = *node_parent(node);
+        unpin_page(pager, page_num);
+        if (root) {
+            break;
+        }
+        page_num = parent_page_num;
+    }
+    u_int32_t count = 0;
+    collect_leaves_after(pager, page_num, levels, *leaf_node_key(leaf, num_cells - 1), false, page_nums, &count, max);
+    return count;
+}
+
+/**
+ * Read-ahead for scans, called as a scan is about to leave leaf for the next one. A scan on its second leaf gets the next
+ * window leaves loaded into the pool in one go (see pager_prefetch()), and the kernel is told about the window after that
+ * (pager_hint()), so those are on their way into the page cache while the scan works through the first batch. The first of
+ * the hinted leaves is the mark: reaching it means the scan is keeping up, so the next read-ahead doubles the window, up to
+ * PREFETCH_MAX_PAGES (or what the pool can spare). A leaf that was loaded ahead but got evicted before the scan reached it means the scan is slower than the
+ * pool turns over, and halves the window.
+ */
+void scan_readahead(Pager* pager, Readahead* readahead, void* leaf) {
+    u_int32_t next_page_num = *leaf_node_next_leaf(leaf);
+    if (next_page_num == 0 || !pager_can_prefetch(pager)) {
+        return;
+    }
+    readahead->leaves_moved++;
+    bool missing = pager_lookup(pager, next_page_num) == NO_FRAME;
+    bool evicted = missing && readahead->ahead > 0;
+    if (readahead->ahead > 0) {
+        readahead->ahead--;
+    }
+
+    if (readahead->window == 0) {
+        // stepping onto one more leaf could still be a short range. a second time, it's a scan
+        if (readahead->leaves_moved < 2) {
+            return;
+        }
+        readahead->window = READAHEAD_MIN_PAGES;
+    } else if (next_page_num == readahead->mark) {
+        readahead->window *= 2;
+    } else if (evicted) {
+        readahead->window = readahead->window / 2 < READAHEAD_MIN_PAGES ? READAHEAD_MIN_PAGES : readahead->window / 2;
+    } else if (!missing) {
+        return;
+    }
+    // a small pool can't take as much as a whole window
+    if (readahead->window > pager_prefetch_limit(pager)) {
+        readahead->window = pager_prefetch_limit(pager);
+    }
+
+    u_int32_t page_nums[2 * PREFETCH_MAX_PAGES];
+    u_int32_t count = collect_next_leaves(pager, leaf, page_nums, 2 * readahead->window);
+    u_int32_t loaded = count < readahead->window ? count : readahead->window;
+    pager_prefetch(pager, page_nums, loaded);
+    pager_hint(pager, page_nums + loaded, count - loaded);
+    readahead->mark = count > loaded ? page_nums[loaded] : 0;
+    readahead->ahead = loaded;
+}
+
+// moves the cursor to the start of the next leaf, or to the end of the table after the last one. a reader latches the next leaf
+// before letting go of this one, unless it's busy: then it lets go, waits for it, and finds its place again from the root,
+// right after the last key of this leaf. that can be anywhere in a leaf, so callers go by cell_num rather than assume 0
+void cursor_next_leaf(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    u_int32_t page_num = cursor->page_num;
+    void* node = get_page(pager, page_num);
+    u_int32_t next_page_num = *leaf_node_next_leaf(node);
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    u_int32_t last_key = num_cells > 0 ? *leaf_node_key(node, num_cells - 1) : 0;
+    scan_readahead(pager, &cursor->readahead, node);
+    unpin_page(pager, page_num);
+
+    if (next_page_num == 0 || last_key == UINT32_MAX) {
+        /* we're at the rightmost leaf!! no more siblings left */
+        cursor->end_of_table = true;
+    } else if (try_latch_page(pager, next_page_num)) {
+        // hand the cursor's pin over from the old leaf to the next one
+        get_page(pager, next_page_num);
+        unpin_page(pager, page_num);
+        unlatch_page(pager, page_num);
+        cursor->page_num = next_page_num;
+        cursor->cell_num = 0;
+    } else {
+        unpin_page(pager, page_num);
+        unlatch_page(pager, page_num);
+        wait_for_page(pager, next_page_num);
+        Cursor* found = table_seek(cursor->table, last_key + 1);
+        Readahead readahead = cursor->readahead;
+        *cursor = *found;
+        cursor->readahead = readahead;
+        free(found);
+    }
+}
+
+// returns a cursor on the first row with id >= key. table_find() can leave the cursor one past the last cell of a leaf when
+// key is bigger than everything in it, so in that case we step over to the next leaf (or the end of the table)
+Cursor* table_seek(Table* table, u_int32_t key) {
+    Cursor* cursor = table_find(table, key);
+    u_int32_t page_num = cursor->page_num;
+
+    void* node = get_page(table->pager, page_num);
+    bool past_end = cursor->cell_num >= *leaf_node_num_cells(node);
+    unpin_page(table->pager, page_num);
+    if (past_end) {
+        cursor_next_leaf(cursor);
+    }
+
+    return cursor;
+}
+
+Cursor* table_start(Table* table) {
+    return table_seek(table, 0);
+}
+
+u_int32_t node_row_count(void* node);
+
+u_int32_t table_num_rows(Table* table) {
+    latch_page(table->pager, table->root_page_num);
+    void* root = get_page(table->pager, table->root_page_num);
+    u_int32_t num_rows = node_row_count(root);
+    unpin_page(table->pager, table->root_page_num);
+    unlatch_page(table->pager, table->root_page_num);
+    return num_rows;
+}
+
+// how many rows have an id smaller than key. on the way down, every internal node adds the counts of the children left of the
+// one the search goes into, so it reads a single page per level
+u_int32_t table_rank(Table* table, u_int32_t key) {
+    Pager* pager = table->pager;
+    u_int32_t page_num = table->root_page_num;
+    u_int32_t rank = 0;
+    latch_page(pager, page_num);
+    while (true) {
+        void* node = get_page(pager, page_num);
+        if (get_node_type(node) == NODE_LEAF) {
+            rank += leaf_node_lower_bound(node, key);
+            unpin_page(pager, page_num);
+            unlatch_page(pager, page_num);
+            return rank;
+        }
+        u_int32_t child_index = internal_node_find_child(node, key);
+        for (u_int32_t i = 0; i < child_index; i++) {
+            rank += *internal_node_child_count(node, i);
+        }
+        u_int32_t child_page_num = *internal_node_child(node, child_index);
+        unpin_page(pager, page_num);
+        if (latch_child(pager, page_num, child_page_num)) {
+            page_num = child_page_num;
+        } else {
+            page_num = table->root_page_num;
+            rank = 0;
+            latch_page(pager, page_num);
+        }
+    }
+}
+
+// returns a cursor on the nth row (counting from 0) in id order, or the end of the table if there aren't that many. the
+// counts lead the way down the same as in table_rank()
+Cursor* table_seek_nth(Table* table, u_int32_t n) {
+    Pager* pager = table->pager;
+    u_int32_t page_num = table->root_page_num;
+    u_int32_t remaining = n;
+    latch_page(pager, page_num);
+    void* node = get_page(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        u_int32_t num_keys = *internal_node_num_keys(node);
+        u_int32_t child_index = 0;
+        while (child_index < num_keys && remaining >= *internal_node_child_count(node, child_index)) {
+            remaining -= *internal_node_child_count(node, child_index);
+            child_index++;
+        }
+        u_int32_t child_page_num = *internal_node_child(node, child_index);
+        unpin_page(pager, page_num);
+        if (latch_child(pager, page_num, child_page_num)) {
+            page_num = child_page_num;
+        } else {
+            page_num = table->root_page_num;
+            remaining = n;
+            latch_page(pager, page_num);
+        }
+        node = get_page(pager, page_num);
+    }
+    n = remaining;
+
+    // the leaf stays pinned (and latched) for the cursor
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = n;
+    cursor->end_of_table = n >= *leaf_node_num_cells(node);
+    memset(&cursor->readahead, 0, sizeof(Readahead));
+    return cursor;
+}
+
+// the id of the nth row. n has to be less than the number of rows
+u_int32_t table_nth_key(Table* table, u_int32_t n) {
+    Cursor* cursor = table_seek_nth(table, n);
+    void* node = get_page(table->pager, cursor->page_num);
+    u_int32_t key = *leaf_node_key(node, cursor->cell_num);
+    unpin_page(table->pager, cursor->page_num);
+    close_cursor(cursor);
+    return key;
+}
+
+// where statements print what they return. NULL means stdout; the server points it at the reply it's building
+__thread FILE* result_output = NULL;
+
+FILE* results() {
+    return result_output != NULL ? result_output : stdout;
+}
+
+void print_row(Row* row) {
+    fprintf(results(), "(%d, %s, %s)\n", row->id, row->username, row->email);
+}
+
+/**
+ * Rows are stored in a compact encoding instead of the padded Row struct:
+ *   id (4 bytes) | username length (1 byte) | username | email length (1 byte) | email
+ * so a row only takes as much space as its strings need. ROW_SIZE is the most it can ever take.
+ */
+void serialize_row_fields(u_int32_t id, const char* username, const char* email, void* destination, u_int32_t* size) {
+    u_int8_t username_length = strlen(username);
+    u_int8_t email_length = strlen(email);
+    u_int8_t* bytes = destination;
+
+    memcpy(bytes, &id, ID_SIZE);
+    bytes += ID_SIZE;
+    *bytes++ = username_length;
+    memcpy(bytes, username, username_length);
+    bytes += username_length;
+    *bytes++ = email_length;
+    memcpy(bytes, email, email_length);
+    bytes += email_length;
+
+    *size = bytes - (u_int8_t*)destination;
+}
+
+// function that converts Row objects to our compact memory setup. returns how many bytes it wrote
+u_int32_t serialize_row(Row* source, void* destination) {
+    u_int32_t size;
+    serialize_row_fields(source->id, source->username, source->email, destination, &size);
+    return size;
+}
+
+// does literally the opposite
+void deserialize_row(void* source, Row* destination) {
+    u_int8_t* bytes = source;
+
+    memcpy(&(destination->id), bytes, ID_SIZE);
+    bytes += ID_SIZE;
+    u_int8_t username_length = *bytes++;
+    memcpy(destination->username, bytes, username_length);
+    destination->username[username_length] = '\0';
+    bytes += username_length;
+    u_int8_t email_length = *bytes++;
+    memcpy(destination->email, bytes, email_length);
+    destination->email[email_length] = '\0';
+}
+
+// table_end() also creates a new Cursor, but places it at the end of the Table
+Cursor* table_end(Table* table) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = table->root_page_num;
+
+    // the cursor keeps this pin until close_cursor()
+    void* root_node = get_page(table->pager, table->root_page_num);
+    u_int32_t num_cells = *leaf_node_num_cells(root_node);
+    cursor->cell_num = num_cells;
+    cursor->end_of_table = true;
+    memset(&cursor->readahead, 0, sizeof(Readahead));
+
+    return cursor;
+}
+
+// cursor_value() replaces previous row_slot() function. it returns the location of the cursor within its associated table.
+// the cursor already holds a pin on its leaf, so we can drop the extra one right away and the pointer stays valid
+void* cursor_value(Cursor* cursor) {
+    u_int32_t page_num = cursor->page_num;
+    void* page = get_page(cursor->table->pager, page_num);
+    unpin_page(cursor->table->pager, page_num);
+
+    return leaf_node_value(page, cursor->cell_num);
+}
+
+// moves the cursor forward in the table. really simple, just increments row number and checks if the end of the table is reached
+void cursor_advance(Cursor* cursor) {
+    Pager* pager = cursor->table->pager;
+    u_int32_t page_num = cursor->page_num;
+    void* node = get_page(pager, page_num);
+
+    cursor->cell_num += 1;
+    bool past_end = cursor->cell_num >= (*leaf_node_num_cells(node));
+    unpin_page(pager, page_num);
+    if (past_end) {
+        /* Go to next leaf node!! */
+        cursor_next_leaf(cursor);
+    }
+}
+
+// opens the database file and keeps track of its size in memory
+Pager* pager_open(const char* filename, u_int32_t num_frames, bool use_mmap) {
+    /**
+     * O_RDWR: Read/write mode
+     * O_CREAT: Create file if it doesn't exist
+     * S_IWUSR: User write permission
+     * S_IRUSR: User read permission
+    */
+    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    
+    if (fd == -1) {
+        printf("Unable to open file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // off_t is a data type used for I/O functionality. among other things its used to handle potentially large files
+    off_t file_length = lseek(fd, 0, SEEK_END);
+
+    Pager* pager = malloc(sizeof(Pager));
+    pager->file_descriptor = fd;
+    pager->file_length = file_length;
+    pager->num_pages = (file_length / PAGE_SIZE);
+
+    if (file_length % PAGE_SIZE != 0) {
+        printf("Db file is not a whole number of pages. Corrupt file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pager->num_dirty = 0;
+    pager->last_checkpoint = time(NULL);
+    pager->wal = NULL;
+    pager->use_mmap = use_mmap;
+    pager->bulk_loading = false;
+    pthread_mutex_init(&pager->latch, NULL);
+    pager->shared = false;
+    pager->concurrent = false;
+    pager->latch_chunks = NULL;
+    pager->num_latch_chunks = 0;
+    pager->write_latches = NULL;
+    pager->num_write_latches = 0;
+    pager->write_latches_capacity = 0;
+    pager->map = NULL;
+    pager->mapped_pages = 0;
+    pager->page_flags = NULL;
+    pager->ring = NULL;
+
+    if (use_mmap) {
+        // reserve the address space without backing it. pager_grow_mapping() maps the file into it piece by piece
+        pager->map = mmap(NULL, MMAP_RESERVE_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pager->map == MAP_FAILED) {
+            printf("Unable to reserve address space for mmap mode: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (pager->num_pages > 0) {
+            pager_grow_mapping(pager, pager->num_pages);
+        }
+        pager->num_frames = 0;
+        pager->frames = NULL;
+        pager->pool = NULL;
+        pager->page_table = NULL;
+        return pager;
+    }
+
+    // all frames share one allocation, and the page table gets about two buckets per frame
+    pager->num_frames = num_frames;
+    pager->frames = calloc(num_frames, sizeof(Frame));
+    // page aligned, so the key array of a leaf starts at the same place within a cache line in every frame
+    if (posix_memalign(&pager->pool, PAGE_SIZE, (size_t)num_frames * PAGE_SIZE) != 0) {
+        printf("Error allocating buffer pool.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (u_int32_t i = 0; i < num_frames; i++) {
+        pager->frames[i].data = pager->pool + (size_t)i * PAGE_SIZE;
+    }
+
+    u_int32_t num_buckets = 1;
+    while (num_buckets < 2 * num_frames) {
+        num_buckets <<= 1;
+    }
+    pager->page_table = malloc(num_buckets * sizeof(int32_t));
+    for (u_int32_t i = 0; i < num_buckets; i++) {
+        pager->page_table[i] = NO_FRAME;
+    }
+    pager->page_table_mask = num_buckets - 1;
+    pager->clock_hand = 0;
+
+    return pager;
+}
+
+// functions for reading and writing the file header on page 0
+char* db_header_magic(void* header) {
+    return header + DB_HEADER_MAGIC_OFFSET;
+}
+
+u_int32_t* db_header_version(void* header) {
+    return header + DB_HEADER_VERSION_OFFSET;
+}
+
+u_int32_t* db_header_page_size(void* header) {
+    return header + DB_HEADER_PAGE_SIZE_OFFSET;
+}
+
+u_int32_t* db_header_root_page(void* header) {
+    return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+u_int32_t* db_header_freelist_head(void* header) {
+    return header + DB_HEADER_FREELIST_HEAD_OFFSET;
+}
+
+u_int32_t* db_header_free_pages(void* header) {
+    return header + DB_HEADER_FREE_PAGES_OFFSET;
+}
+
+u_int32_t* db_header_index_root(void* header, IndexColumn column) {
+    return header + DB_HEADER_INDEX_ROOTS_OFFSET + column * DB_HEADER_INDEX_ROOT_SIZE;
+}
+
+u_int32_t* free_page_next(void* page) {
+    return page + FREE_PAGE_NEXT_OFFSET;
+}
+
+void initialize_db_header(void* header, u_int32_t root_page_num) {
+    memset(header, 0, PAGE_SIZE);
+    memcpy(db_header_magic(header), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE);
+    *db_header_version(header) = DB_FORMAT_VERSION;
+    *db_header_page_size(header) = PAGE_SIZE;
+    *db_header_root_page(header) = root_page_num;
+}
+
+void set_node_parent(Pager* pager, u_int32_t page_num, u_int32_t parent_page_num);
+
+void rebuild_internal_nodes(Pager* pager, u_int32_t root_page_num);
+
+/**
+ * Files written before there was a header keep the root on page 0. The root gets copied to the end of the file and page 0
+ * becomes the header. Such files predate row counts too, so the caller rebuilds the internal nodes (pointing every child at
+ * its new parent on the way) and commits it all as a single logged statement. A crash halfway through leaves either the old
+ * file or the upgraded one.
+ */
+u_int32_t upgrade_headerless_file(Pager* pager) {
+    u_int32_t root_page_num = pager->num_pages;
+    void* old_root = get_page(pager, DB_HEADER_PAGE_NUM);
+    void* root = get_page(pager, root_page_num);
+    memcpy(root, old_root, PAGE_SIZE);
+    initialize_db_header(old_root, root_page_num);
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+    mark_page_dirty(pager, root_page_num);
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+    unpin_page(pager, root_page_num);
+    return root_page_num;
+}
+
+/**
+ * The page size a file was created with, read straight from its header before there is a pager to read it with. Every page
+ * size is a multiple of the smallest one, so the header always fits in the first MIN_PAGE_SIZE bytes. A new (empty) file gets
+ * new_file_page_size, and a file from before the header existed always used 4 KB pages.
+ */
+u_int32_t db_file_page_size(const char* filename, u_int32_t new_file_page_size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return new_file_page_size;
+    }
+    u_int8_t header[MIN_PAGE_SIZE];
+    ssize_t bytes_read = pread(fd, header, MIN_PAGE_SIZE, 0);
+    close(fd);
+    if (bytes_read <= 0) {
+        return new_file_page_size;
+    }
+    if (bytes_read < MIN_PAGE_SIZE || memcmp(db_header_magic(header), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0) {
+        return DEFAULT_PAGE_SIZE;
+    }
+    u_int32_t page_size = *db_header_page_size(header);
+    if (!valid_page_size(page_size)) {
+        printf("Db file has an invalid page size of %d bytes. Corrupt file.\n", page_size);
+        exit(EXIT_FAILURE);
+    }
+    return page_size;
+}
+
+void choose_bytes_equal();
+
+// function that establishes a connection to the database file. this function replaces the previous new_table(), and now takes the file name and the open options
+Table* db_open(const char* filename, DbOptions* options) {
+    // the page size of an existing file wins over options->page_size, which is only for creating one
+    set_page_size(db_file_page_size(filename, options->page_size));
+    choose_count_keys_below();
+    choose_bytes_equal();
+    Pager* pager = pager_open(filename, options->num_frames, options->use_mmap);
+    pager->checkpoint_pages = options->checkpoint_pages;
+    pager->checkpoint_seconds = options->checkpoint_seconds;
+    if (options->use_io_uring) {
+        pager->ring = io_ring_open(IO_RING_ENTRIES);
+    }
+    // the log is opened even without use_wal: one left behind by a run that did use it gets replayed into the file and removed.
+    // otherwise its pages would come back over this run's writes the next time the log is used
+    wal_open(pager, filename, options->wal_group);
+    if (!options->use_wal) {
+        wal_close(pager->wal);
+        pager->wal = NULL;
+    }
+
+    Table* table = (Table*)malloc(sizeof(Table));
+    table->pager = pager;
+    table->fill_factor = options->fill_factor;
+    table->rightmost_leaf = 0;
+    table->sort_memory = (size_t)options->sort_memory_kb * 1024;
+    table->num_threads = options->num_threads;
+    memset(table->index_roots, 0, sizeof(table->index_roots));
+    pthread_mutex_init(&table->writer, NULL);
+    pager->concurrent = options->concurrent;
+    pager->shared = options->concurrent;
+
+    if (pager->num_pages == 0) {
+        // a new file gets its header and an empty root leaf right after it
+        table->root_page_num = DB_HEADER_PAGE_NUM + 1;
+        void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+        initialize_db_header(header, table->root_page_num);
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        unpin_page(pager, DB_HEADER_PAGE_NUM);
+
+        void* root_node = get_page(pager, table->root_page_num);
+        initialize_leaf_node(root_node);
+        set_node_root(root_node, true);
+        mark_page_dirty(pager, table->root_page_num);
+        unpin_page(pager, table->root_page_num);
+        // put the header on disk right away, so the file is recognizable even if nothing else ever gets written
+        pager_commit(pager);
+        pager_checkpoint(pager);
+        return table;
+    }
+
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    bool has_header = memcmp(db_header_magic(header), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) == 0;
+    if (has_header && *db_header_version(header) > DB_FORMAT_VERSION) {
+        printf("Db file has format version %d, this build only reads up to %d.\n", *db_header_version(header), DB_FORMAT_VERSION);
+        exit(EXIT_FAILURE);
+    }
+    table->root_page_num = *db_header_root_page(header);
+    u_int32_t version = has_header ? *db_header_version(header) : 0;
+    for (u_int32_t i = 0; has_header && i < NUM_INDEX_COLUMNS; i++) {
+        table->index_roots[i] = *db_header_index_root(header, i);
+    }
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+
+    if (!has_header) {
+        table->root_page_num = upgrade_headerless_file(pager);
+    }
+    if (version < DB_FORMAT_VERSION) {
+        rebuild_internal_nodes(pager, table->root_page_num);
+        header = get_page(pager, DB_HEADER_PAGE_NUM);
+        *db_header_version(header) = DB_FORMAT_VERSION;
+        mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+        unpin_page(pager, DB_HEADER_PAGE_NUM);
+        pager_commit(pager);
+    }
+
+    return table;
+}
+
+// hands out a page for a new node. pages on the freelist are reused first, and only once it's empty does the file grow.
+// the caller initializes the page and marks it dirty
+u_int32_t get_unused_page_num(Pager* pager) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    u_int32_t page_num = *db_header_freelist_head(header);
+    if (page_num == 0) {
+        unpin_page(pager, DB_HEADER_PAGE_NUM);
+        return pager->num_pages;
+    }
+
+    void* page = get_page(pager, page_num);
+    *db_header_freelist_head(header) = *free_page_next(page);
+    *db_header_free_pages(header) -= 1;
+    unpin_page(pager, page_num);
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+    return page_num;
+}
+
+// puts a page that is no longer part of the tree on the freelist
+void free_page(Pager* pager, u_int32_t page_num) {
+    void* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    void* page = get_page(pager, page_num);
+    memset(page, 0, PAGE_SIZE);
+    *((u_int8_t*)(page + NODE_TYPE_OFFSET)) = NODE_TYPE_BYTE_FREE;
+    *free_page_next(page) = *db_header_freelist_head(header);
+    *db_header_freelist_head(header) = page_num;
+    *db_header_free_pages(header) += 1;
+    mark_page_dirty(pager, page_num);
+    mark_page_dirty(pager, DB_HEADER_PAGE_NUM);
+    unpin_page(pager, page_num);
+    unpin_page(pager, DB_HEADER_PAGE_NUM);
+}
+
+// the largest key in a subtree lives in its rightmost leaf
+u_int32_t get_node_max_key(Pager* pager, u_int32_t page_num) {
+    void* node = get_page(pager, page_num);
+    u_int32_t max_key;
+    if (get_node_type(node) == NODE_LEAF) {
+        max_key = *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+    } else {
+        max_key = get_node_max_key(pager, *internal_node_right_child(node));
+    }
+    unpin_page(pager, page_num);
+    return max_key;
+}
+
+u_int32_t* node_parent(void* node) {
+    return node + PARENT_POINTER_OFFSET;
+}
+
+// points a child node at its (possibly new) parent
+void set_node_parent(Pager* pager, u_int32_t page_num, u_int32_t parent_page_num) {
+    void* node = get_page(pager, page_num);
+    if (*node_parent(node) != parent_page_num) {
+        *node_parent(node) = parent_page_num;
+        mark_page_dirty(pager, page_num);
+    }
+    unpin_page(pager, page_num);
+}
+
+/**
+ * Row counts. The count a parent keeps for a child has to follow every row that comes or goes below it. A plain insert or
+ * delete just adds its +1 or -1 to every count on the way up to the root (add_row_counts()). Anything that moves rows or
+ * children between nodes sets the counts of the nodes it touched from what they hold now, and then does the same for every
+ * node above them (update_row_counts()), so it doesn't need to know by how much things changed.
+ */
+u_int32_t internal_node_child_index(void* node, u_int32_t child_page_num);
+
+// rows in the subtree of a node, from the node alone
+u_int32_t node_row_count(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+    u_int32_t count = 0;
+    for (u_int32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+        count += *internal_node_child_count(node, i);
+    }
+    return count;
+}
+
+// sets a parent's count for one of its children from the child
+void internal_node_refresh_count(Pager* pager, void* parent, u_int32_t child_num) {
+    u_int32_t child_page_num = *internal_node_child(parent, child_num);
+    void* child = get_page(pager, child_page_num);
+    *internal_node_child_count(parent, child_num) = node_row_count(child);
+    unpin_page(pager, child_page_num);
+}
+
+void add_row_counts(Pager* pager, u_int32_t page_num, int32_t delta) {
+    while (true) {
+        void* node = get_page(pager, page_num);
+        bool is_root = is_node_root(node);
+        u_int32_t parent_page_num = *node_parent(node);
+        unpin_page(pager, page_num);
+        if (is_root) {
+            return;
+        }
+
+        void* parent = get_page(pager, parent_page_num);
+        *internal_node_child_count(parent, internal_node_child_index(parent, page_num)) += delta;
+        mark_page_dirty(pager, parent_page_num);
+        unpin_page(pager, parent_page_num);
+        page_num = parent_page_num;
+    }
+}
+
+void update_row_counts(Pager* pager, u_int32_t page_num) {
+    while (true) {
+        void* node = get_page(pager, page_num);
+        bool is_root = is_node_root(node);
+        u_int32_t parent_page_num = *node_parent(node);
+        u_int32_t count = node_row_count(node);
+        unpin_page(pager, page_num);
+        if (is_root) {
+            return;
+        }
+
+        void* parent = get_page(pager, parent_page_num);
+        u_int32_t* parent_count = internal_node_child_count(parent, internal_node_child_index(parent, page_num));
+        if (*parent_count != count) {
+            *parent_count = count;
+            mark_page_dirty(pager, parent_page_num);
+        }
+        unpin_page(pager, parent_page_num);
+        page_num = parent_page_num;
+    }
+}
+
+// walks a tree whose internal nodes still have the layout from before row counts. leaves are listed in key order, internal
+// pages in the order they're reached (root first)
+void legacy_tree_collect(Pager* pager, u_int32_t page_num, u_int32_t* leaves, u_int32_t* num_leaves, u_int32_t* internals,
+                         u_int32_t* num_internals) {
+    void* node = get_page(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        leaves[(*num_leaves)++] = page_num;
+        unpin_page(pager, page_num);
+        return;
+    }
+    internals[(*num_internals)++] = page_num;
+
+    u_int32_t num_keys = *internal_node_num_keys(node);
+    u_int32_t* children = malloc((num_keys + 1) * sizeof(u_int32_t));
+    for (u_int32_t i = 0; i < num_keys; i++) {
+        children[i] = *(u_int32_t*)(node + LEGACY_INTERNAL_NODE_CELLS_OFFSET + i * LEGACY_INTERNAL_NODE_CELL_SIZE);
+    }
+    children[num_keys] = *internal_node_right_child(node);
+    unpin_page(pager, page_num);
+
+    for (u_int32_t i = 0; i <= num_keys; i++) {
+        legacy_tree_collect(pager, children[i], leaves, num_leaves, internals, num_internals);
+    }
+    free(children);
+}
+
+/**
+ * Internal nodes from before format version 2 have no row counts, and fit more keys than the current layout does, so they
+ * can't be converted one at a time. Instead the internal levels are built again on top of the leaves, which stay where they
+ * are: the old internal pages (except the root's) go on the freelist, and each new level spreads its children evenly over as
+ * few nodes as it can until one node, the root page, takes what's left. The caller commits.
+ */
+void rebuild_internal_nodes(Pager* pager, u_int32_t root_page_num) {
+    u_int32_t* pages = malloc(pager->num_pages * sizeof(u_int32_t));
+    u_int32_t* internals = malloc(pager->num_pages * sizeof(u_int32_t));
+    u_int32_t num_items = 0;
+    u_int32_t num_internals = 0;
+    legacy_tree_collect(pager, root_page_num, pages, &num_items, internals, &num_internals);
+    for (u_int32_t i = 1; i < num_internals; i++) {
+        free_page(pager, internals[i]);
+    }
+    free(internals);
+    if (num_internals == 0) {
+        // the root is a leaf, nothing to rebuild
+        free(pages);
+        return;
+    }
+
+    u_int32_t* max_keys = malloc(num_items * sizeof(u_int32_t));
+    u_int32_t* counts = malloc(num_items * sizeof(u_int32_t));
+    for (u_int32_t i = 0; i < num_items; i++) {
+        if (i % PREFETCH_MAX_PAGES == 0) {
+            pager_prefetch(pager, pages + i, num_items - i);
+        }
+        void* leaf = get_page(pager, pages[i]);
+        counts[i] = *leaf_node_num_cells(leaf);
+        max_keys[i] = counts[i] > 0 ? *leaf_node_key(leaf, counts[i] - 1) : 0;
+        unpin_page(pager, pages[i]);
+    }
+
+    // every level overwrites the lists with its own nodes, which never gets ahead of the children being read
+    bool done = false;
+    while (!done) {
+        done = num_items <= INTERNAL_NODE_MAX_KEYS + 1;
+        u_int32_t num_nodes = done ? 1 : (num_items + INTERNAL_NODE_MAX_KEYS) / (INTERNAL_NODE_MAX_KEYS + 1);
+        u_int32_t item = 0;
+        for (u_int32_t n = 0; n < num_nodes; n++) {
+            u_int32_t num_children = num_items / num_nodes + (n < num_items % num_nodes ? 1 : 0);
+            u_int32_t page_num = done ? root_page_num : get_unused_page_num(pager);
+            void* node = get_page(pager, page_num);
+            initialize_internal_node(node);
+            set_node_root(node, done);
+            *node_parent(node) = 0;
+            *internal_node_num_keys(node) = num_children - 1;
+
+            u_int32_t total = 0;
+            for (u_int32_t c = 0; c < num_children; c++) {
+                *internal_node_child(node, c) = pages[item + c];
+                if (c < num_children - 1) {
+                    *internal_node_key(node, c) = max_keys[item + c];
+                }
+                *internal_node_child_count(node, c) = counts[item + c];
+                total += counts[item + c];
+                set_node_parent(pager, pages[item + c], page_num);
+            }
+            mark_page_dirty(pager, page_num);
+            unpin_page(pager, page_num);
+
+            pages[n] = page_num;
+            max_keys[n] = max_keys[item + num_children - 1];
+            counts[n] = total;
+            item += num_children;
+        }
+        num_items = num_nodes;
+    }
+
+    free(pages);
+    free(max_keys);
+    free(counts);
+}
+
+// helper for the split functions. the root just split and right_child_page_num already holds its upper half.
+// the root has to stay on the same page, so its lower half gets copied into a freshly allocated left child and the root page
+// becomes an internal node pointing at both halves. left_child_max_key is the separator between them
+void create_new_root(Table* table, u_int32_t right_child_page_num, u_int32_t left_child_max_key) {
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+    u_int32_t left_child_page_num = get_unused_page_num(pager);
+    void* left_child = get_page(pager, left_child_page_num);
+
+    // old root copied to left child
+    memcpy(left_child, root, PAGE_SIZE);
+    set_node_root(left_child, false);
+
+    // if the old root was internal, all of its children just moved to a new page
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        u_int32_t num_keys = *internal_node_num_keys(left_child);
+        for (u_int32_t i = 0; i <= num_keys; i++) {
+            set_node_parent(pager, *internal_node_child(left_child, i), left_child_page_num);
+        }
+    }
+
+    // root page is new internal node. it has a single key and two children
+    initialize_internal_node(root);
+    set_node_root(root, true);
+    *internal_node_num_keys(root) = 1;
+    *internal_node_child(root, 0) = left_child_page_num;
+    *internal_node_key(root, 0) = left_child_max_key;
+    *internal_node_right_child(root) = right_child_page_num;
+    *internal_node_child_count(root, 0) = node_row_count(left_child);
+    internal_node_refresh_count(pager, root, 1);
+    *node_parent(left_child) = table->root_page_num;
+    set_node_parent(pager, right_child_page_num, table->root_page_num);
+
+    mark_page_dirty(pager, table->root_page_num);
+    mark_page_dirty(pager, left_child_page_num);
+    unpin_page(pager, table->root_page_num);
+    unpin_page(pager, left_child_page_num);
+}
+
+void internal_node_insert(Table* table, u_int32_t parent_page_num, u_int32_t new_child_page_num, u_int32_t split_key);
+
+// whether page_num is the last node on its level, i.e. the right child all the way up to the root
+bool node_on_right_edge(Pager* pager, u_int32_t page_num) {
+    while (true) {
+        void* node = get_page(pager, page_num);
+        bool root = is_node_root(node);
+        u_int32_t parent_page_num = *node_parent(node);
+        unpin_page(pager, page_num);
+        if (root) {
+            return true;
+        }
+        void* parent = get_page(pager, parent_page_num);
+        bool right_child = *internal_node_right_child(parent) == page_num;
+        unpin_page(pager, parent_page_num);
+        if (!right_child) {
+            return false;
+        }
+        page_num = parent_page_num;
+    }
+}
+
+// the internal node is full, so the new child goes in while its cells are divided between it and a new right sibling.
+// the middle key moves up into the parent (or into a new root if this node was the root)
+void internal_node_split_and_insert(Table* table, u_int32_t page_num, u_int32_t new_child_page_num, u_int32_t split_key) {
+    Pager* pager = table->pager;
+    void* old_node = get_page(pager, page_num);
+    u_int32_t num_keys = *internal_node_num_keys(old_node);
+
+    /**
+     * Lay out all num_keys + 2 children and num_keys + 1 keys in order, new child included.
+     * The child that split keeps its slot with split_key as its new max, and the new child follows it with the old max.
+     */
+    u_int32_t* children = malloc((num_keys + 2) * sizeof(u_int32_t));
+    u_int32_t* keys = malloc((num_keys + 1) * sizeof(u_int32_t));
+    u_int32_t* counts = malloc((num_keys + 2) * sizeof(u_int32_t));
+    u_int32_t index = internal_node_find_child(old_node, split_key);
+    u_int32_t count = 0;
+    for (u_int32_t i = 0; i <= num_keys; i++) {
+        children[count] = *internal_node_child(old_node, i);
+        counts[count] = *internal_node_child_count(old_node, i);
+        if (i < num_keys) {
+            keys[count] = *internal_node_key(old_node, i);
+        }
+        if (i == index) {
+            // the two halves of the child that split count what they hold now
+            void* child = get_page(pager, children[count]);
+            counts[count] = node_row_count(child);
+            unpin_page(pager, children[count]);
+            keys[count] = split_key;
+            count++;
+            children[count] = new_child_page_num;
+            void* new_child = get_page(pager, new_child_page_num);
+            counts[count] = node_row_count(new_child);
+            unpin_page(pager, new_child_page_num);
+            if (i < num_keys) {
+                keys[count] = *internal_node_key(old_node, i);
+            }
+        }
+        count++;
+    }
+
+    /**
+     * Left half stays on the old page, right half goes to a new page.
+     * The key between them is the left half's max, which becomes the separator in the parent.
+     * When it was the last child that split, the rows are being appended and nothing will land on the left again, so it keeps
+     * fill_factor percent of the children instead (see leaf_node_split_and_insert()). Each side keeps at least two.
+     */
+    u_int32_t left_children = count / 2;
+    if (index == num_keys && node_on_right_edge(pager, page_num)) {
+        left_children = count * table->fill_factor / 100;
+        if (left_children > count - 2) {
+            left_children = count - 2;
+        }
+        if (left_children < 2) {
+            left_children = 2;
+        }
+    }
+    u_int32_t separator = keys[left_children - 1];
+
+    *internal_node_num_keys(old_node) = left_children - 1;
+    for (u_int32_t i = 0; i < left_children - 1; i++) {
+        *internal_node_child(old_node, i) = children[i];
+        *internal_node_key(old_node, i) = keys[i];
+        *internal_node_child_count(old_node, i) = counts[i];
+    }
+    *internal_node_right_child(old_node) = children[left_children - 1];
+    *internal_node_child_count(old_node, left_children - 1) = counts[left_children - 1];
+    mark_page_dirty(pager, page_num);
+
+    u_int32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    initialize_internal_node(new_node);
+    *node_parent(new_node) = *node_parent(old_node);
+    *internal_node_num_keys(new_node) = count - left_children - 1;
+    for (u_int32_t i = left_children; i < count - 1; i++) {
+        *internal_node_child(new_node, i - left_children) = children[i];
+        *internal_node_key(new_node, i - left_children) = keys[i];
+        *internal_node_child_count(new_node, i - left_children) = counts[i];
+    }
+    *internal_node_right_child(new_node) = children[count - 1];
+    *internal_node_child_count(new_node, count - left_children - 1) = counts[count - 1];
+    mark_page_dirty(pager, new_page_num);
+
+    // every child that moved needs to know its new parent
+    for (u_int32_t i = left_children; i < count; i++) {
+        set_node_parent(pager, children[i], new_page_num);
+    }
+    free(children);
+    free(keys);
+    free(counts);
+
+    bool old_node_was_root = is_node_root(old_node);
+    u_int32_t parent_page_num = *node_parent(old_node);
+    unpin_page(pager, page_num);
+    unpin_page(pager, new_page_num);
+
+    if (old_node_was_root) {
+        create_new_root(table, new_page_num, separator);
+    } else {
+        internal_node_insert(table, parent_page_num, new_page_num, separator);
+    }
+}
+
+// a child of this node just split. new_child_page_num took over every key above split_key, so it goes right after the child
+// that split, which now ends at split_key
+void internal_node_insert(Table* table, u_int32_t parent_page_num, u_int32_t new_child_page_num, u_int32_t split_key) {
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    u_int32_t num_keys = *internal_node_num_keys(parent);
+
+    if (num_keys >= INTERNAL_NODE_MAX_KEYS) {
+        unpin_page(pager, parent_page_num);
+        internal_node_split_and_insert(table, parent_page_num, new_child_page_num, split_key);
+        return;
+    }
+
+    u_int32_t index = internal_node_find_child(parent, split_key);
+
+    // make room for the new cell
+    for (u_int32_t i = num_keys; i > index; i--) {
+        memcpy(internal_node_cell(parent, i), internal_node_cell(parent, i - 1), INTERNAL_NODE_CELL_SIZE);
+    }
+    *internal_node_num_keys(parent) = num_keys + 1;
+
+    if (index == num_keys) {
+        // the right child split. it becomes the last cell and the new child takes over as right child
+        *internal_node_child(parent, index) = *internal_node_right_child(parent);
+        *internal_node_key(parent, index) = split_key;
+        *internal_node_right_child(parent) = new_child_page_num;
+    } else {
+        // cell index + 1 is a copy of the split child's cell, and its old max key is now the new child's max
+        *internal_node_key(parent, index) = split_key;
+        *internal_node_child(parent, index + 1) = new_child_page_num;
+    }
+    internal_node_refresh_count(pager, parent, index);
+    internal_node_refresh_count(pager, parent, index + 1);
+
+    mark_page_dirty(pager, parent_page_num);
+    unpin_page(pager, parent_page_num);
+    update_row_counts(pager, parent_page_num);
+}
+
+/**
+ * Rebuilds two neighbouring leaves from cells that are already in key order, divided so the left one holds left_percent of
+ * the bytes (50 for an even split). The left leaf takes cells until it has at least that much, but always leaves one for the
+ * right. Root flag, parent and next leaf of both stay as they were. records must not point into either leaf. Returns the max
+ * key of the left leaf.
+ */
+u_int32_t leaf_nodes_fill(void* left, void* right, u_int32_t num_cells, u_int32_t* keys, void** records, u_int32_t* sizes,
+                          u_int32_t left_percent) {
+    u_int32_t total_bytes = 0;
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        total_bytes += LEAF_NODE_SLOT_SIZE + sizes[i];
+    }
+    u_int32_t left_count = 0;
+    u_int32_t left_bytes = 0;
+    while (left_count < num_cells - 1 && left_bytes < total_bytes * left_percent / 100) {
+        left_bytes += LEAF_NODE_SLOT_SIZE + sizes[left_count];
+        left_count++;
+    }
+
+    void* nodes[2] = { left, right };
+    for (u_int32_t n = 0; n < 2; n++) {
+        bool is_root = is_node_root(nodes[n]);
+        u_int32_t parent_page_num = *node_parent(nodes[n]);
+        u_int32_t next_leaf = *leaf_node_next_leaf(nodes[n]);
+        initialize_leaf_node(nodes[n]);
+        set_node_root(nodes[n], is_root);
+        *node_parent(nodes[n]) = parent_page_num;
+        *leaf_node_next_leaf(nodes[n]) = next_leaf;
+    }
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        if (i < left_count) {
+            leaf_node_insert_record(left, i, keys[i], records[i], sizes[i]);
+        } else {
+            leaf_node_insert_record(right, i - left_count, keys[i], records[i], sizes[i]);
+        }
+    }
+    return keys[left_count - 1];
+}
+
+// helper function for leaf_node_insert(); if no space is left on the leaf node, it splits it until an upper and lower node
+void leaf_node_split_and_insert(Cursor* cursor, u_int32_t key, Row* value) {
+    /**
+     * Splitting the node into two
+     * */
+    Pager* pager = cursor->table->pager;
+    void* old_node = get_page(pager, cursor->page_num);
+    u_int32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    initialize_leaf_node(new_node);
+    *node_parent(new_node) = *node_parent(old_node);
+    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+
+    /**
+     * Line up the existing cells and the new one in key order. The old leaf gets rebuilt from scratch, so its rows are read
+     * from a copy while both leaves are filled
+     */
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, old_node, PAGE_SIZE);
+    u_int8_t new_record[ROW_SIZE];
+    u_int32_t new_size = serialize_row(value, new_record);
+
+    u_int32_t num_cells = *leaf_node_num_cells(copy) + 1;
+    u_int32_t keys[num_cells];
+    void* records[num_cells];
+    u_int32_t sizes[num_cells];
+    for (u_int32_t i = 0, source = 0; i < num_cells; i++) {
+        if (i == cursor->cell_num) {
+            keys[i] = key;
+            records[i] = new_record;
+            sizes[i] = new_size;
+        } else {
+            keys[i] = *leaf_node_key(copy, source);
+            records[i] = leaf_node_value(copy, source);
+            sizes[i] = encoded_row_size(records[i]);
+            source++;
+        }
+    }
+
+    /**
+     * An even split leaves both leaves half empty for good when ids keep growing, since nothing lands in the left one again.
+     * So when the last leaf splits on a key past all of its own, the left one is kept as full as .load would leave it and
+     * the new leaf starts out nearly empty for the rows still to come. With a fill factor of 100 it only gets the new row.
+     */
+    bool appending = *leaf_node_next_leaf(old_node) == 0 && cursor->cell_num == num_cells - 1;
+    u_int32_t left_percent = appending ? cursor->table->fill_factor : 50;
+    if (appending) {
+        cursor->table->rightmost_leaf = new_page_num;
+    }
+
+    bool old_node_was_root = is_node_root(old_node);
+    u_int32_t parent_page_num = *node_parent(old_node);
+    *leaf_node_next_leaf(old_node) = new_page_num;
+    u_int32_t new_max = leaf_nodes_fill(old_node, new_node, num_cells, keys, records, sizes, left_percent);
+    mark_page_dirty(pager, cursor->page_num);
+    mark_page_dirty(pager, new_page_num);
+
+    /**
+     * Update nodes' parent
+     */
+    unpin_page(pager, cursor->page_num);
+    unpin_page(pager, new_page_num);
+
+    if (old_node_was_root) {
+        create_new_root(cursor->table, new_page_num, new_max);
+    } else {
+        internal_node_insert(cursor->table, parent_page_num, new_page_num, new_max);
+    }
+}
+
+// inserts a node into the B-tree
+void leaf_node_insert(Cursor* cursor, u_int32_t key, Row* value) {
+    void* node = get_page(cursor->table->pager, cursor->page_num);
+
+    u_int8_t record[ROW_SIZE];
+    u_int32_t size = serialize_row(value, record);
+    if (!leaf_node_insert_record(node, cursor->cell_num, key, record, size)) {
+        unpin_page(cursor->table->pager, cursor->page_num);
+        leaf_node_split_and_insert(cursor, key, value);
+        return;
+    }
+
+    mark_page_dirty(cursor->table->pager, cursor->page_num);
+    unpin_page(cursor->table->pager, cursor->page_num);
+    add_row_counts(cursor->table->pager, cursor->page_num, 1);
+}
+
+/**
+ * Inserts a run of cells, sorted by key, into a leaf in a single merge over its slot directory, instead of shifting the cells
+ * after each one in turn. Keys the leaf already has, or that repeat in the run, are skipped (their size is zeroed) and added
+ * to *duplicates. Returns false, leaving the leaf alone, if the cells don't all fit.
+ */
+bool leaf_node_insert_records(void* node, u_int32_t count, u_int32_t* keys, void** records, u_int32_t* sizes,
+                              u_int32_t* duplicates) {
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    u_int32_t* node_keys = leaf_node_keys(node);
+
+    // first a walk over the keys alone, to find the duplicates and what the rest will take
+    u_int32_t needed = 0;
+    u_int32_t num_added = 0;
+    u_int32_t num_duplicates = 0;
+    u_int32_t cell = 0;
+    for (u_int32_t i = 0; i < count; i++) {
+        while (cell < num_cells && node_keys[cell] < keys[i]) {
+            cell++;
+        }
+        if ((cell < num_cells && node_keys[cell] == keys[i]) || (i > 0 && keys[i] == keys[i - 1])) {
+            sizes[i] = 0;
+            num_duplicates++;
+            continue;
+        }
+        needed += LEAF_NODE_SLOT_SIZE + sizes[i];
+        num_added++;
+    }
+    if (leaf_node_gap(node) < needed) {
+        if (leaf_node_gap(node) + *leaf_node_fragmented(node) < needed) {
+            return false;
+        }
+        leaf_node_compact(node);
+    }
+    *duplicates += num_duplicates;
+    if (num_added == 0) {
+        return true;
+    }
+
+    // then the merge. the old slots are read from a copy, since the keys grow into where the row offsets used to be
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    u_int32_t* old_keys = leaf_node_keys(copy);
+    u_int16_t* old_offsets = leaf_node_row_offsets(copy);
+
+    *leaf_node_num_cells(node) = num_cells + num_added;
+    u_int16_t* new_offsets = leaf_node_row_offsets(node);
+    u_int32_t content_start = *leaf_node_content_start(node);
+    u_int32_t new_cell = 0;
+    cell = 0;
+    for (u_int32_t i = 0; i < count; i++) {
+        if (sizes[i] == 0) {
+            continue;
+        }
+        while (cell < num_cells && old_keys[cell] < keys[i]) {
+            node_keys[new_cell] = old_keys[cell];
+            new_offsets[new_cell++] = old_offsets[cell++];
+        }
+        content_start -= sizes[i];
+        memcpy(node + content_start, records[i], sizes[i]);
+        node_keys[new_cell] = keys[i];
+        new_offsets[new_cell++] = content_start;
+    }
+    while (cell < num_cells) {
+        node_keys[new_cell] = old_keys[cell];
+        new_offsets[new_cell++] = old_offsets[cell++];
+    }
+    *leaf_node_content_start(node) = content_start;
+    return true;
+}
+
+/**
+ * Deleting. A row is removed from its leaf, and if that leaves the leaf less than a third full it's rebalanced with a sibling
+ * under the same parent: the two merge if everything fits into one page, otherwise their cells are divided evenly between
+ * them. A merge takes a child away from the parent, which can make the parent underfull in turn, all the way up to the root.
+ * A root left with a single child is replaced by that child. Pages that drop out of the tree go on the freelist.
+ *
+ * Separator keys in internal nodes are only upper bounds after a delete (the max of a child can shrink without the key
+ * changing), which is all internal_node_find_child() needs.
+ */
+
+// bytes a leaf needs for its cells, slots plus rows. fragmented bytes don't count since compaction gets them back
+u_int32_t leaf_node_used_bytes(void* node) {
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    return num_cells * LEAF_NODE_SLOT_SIZE + (PAGE_SIZE - *leaf_node_content_start(node)) - *leaf_node_fragmented(node);
+}
+
+// the reverse of leaf_node_insert_record(). the row's bytes stay where they are and count as fragmented until a compaction
+void leaf_node_delete_cell(void* node, u_int32_t cell_num) {
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    u_int16_t* old_offsets = leaf_node_row_offsets(node);
+    *leaf_node_fragmented(node) += encoded_row_size(node + old_offsets[cell_num]);
+
+    // keys close the gap first, then the row offsets array moves down by one key, and by one more offset after cell_num
+    u_int32_t* keys = leaf_node_keys(node);
+    memmove(keys + cell_num, keys + cell_num + 1, (num_cells - cell_num - 1) * LEAF_NODE_KEY_SIZE);
+    u_int16_t* new_offsets = (void*)old_offsets - LEAF_NODE_KEY_SIZE;
+    memmove(new_offsets, old_offsets, cell_num * LEAF_NODE_ROW_OFFSET_SIZE);
+    memmove(new_offsets + cell_num, old_offsets + cell_num + 1, (num_cells - cell_num - 1) * LEAF_NODE_ROW_OFFSET_SIZE);
+    *leaf_node_num_cells(node) = num_cells - 1;
+
+    if (num_cells == 1) {
+        *leaf_node_content_start(node) = PAGE_SIZE;
+        *leaf_node_fragmented(node) = 0;
+    }
+}
+
+/**
+ * Replaces the row of a cell, keeping its key and its place in the slot directory. A row that didn't grow is written over the
+ * old one, a bigger one goes into the gap and the slot is pointed at it; either way the bytes it no longer uses count as
+ * fragmented. Only when the gap is too small does the cell come out and go back in, which compacts the leaf.
+ * Returns false if the leaf can't hold the new row even with the old one's bytes given back.
+ */
+bool leaf_node_update_record(void* node, u_int32_t cell_num, void* record, u_int32_t size) {
+    u_int16_t* row_offsets = leaf_node_row_offsets(node);
+    u_int32_t old_size = encoded_row_size(node + row_offsets[cell_num]);
+
+    if (size <= old_size) {
+        memcpy(node + row_offsets[cell_num], record, size);
+        *leaf_node_fragmented(node) += old_size - size;
+        return true;
+    }
+    if (leaf_node_gap(node) >= size) {
+        u_int32_t content_start = *leaf_node_content_start(node) - size;
+        memcpy(node + content_start, record, size);
+        *leaf_node_content_start(node) = content_start;
+        row_offsets[cell_num] = content_start;
+        *leaf_node_fragmented(node) += old_size;
+        return true;
+    }
+    if (leaf_node_gap(node) + *leaf_node_fragmented(node) + old_size < size) {
+        return false;
+    }
+    u_int32_t key = *leaf_node_key(node, cell_num);
+    leaf_node_delete_cell(node, cell_num);
+    return leaf_node_insert_record(node, cell_num, key, record, size);
+}
+
+// position of a child among the children of an internal node
+u_int32_t internal_node_child_index(void* node, u_int32_t child_page_num) {
+    u_int32_t num_keys = *internal_node_num_keys(node);
+    for (u_int32_t i = 0; i <= num_keys; i++) {
+        if (*internal_node_child(node, i) == child_page_num) {
+            return i;
+        }
+    }
+    printf("Page %d is not a child of its parent.\n", child_page_num);
+    exit(EXIT_FAILURE);
+}
+
+// an underfull node pairs up with its right sibling, or its left one if it's the right child. returns the left child's index
+u_int32_t internal_node_sibling_pair(void* parent, u_int32_t child_page_num) {
+    u_int32_t index = internal_node_child_index(parent, child_page_num);
+    return index < *internal_node_num_keys(parent) ? index : index - 1;
+}
+
+void internal_node_rebalance(Table* table, u_int32_t page_num);
+
+// the child at index + 1 was merged into the one at index. its cell goes away, and the merged child takes over its key
+// (or its place as the right child)
+void internal_node_remove_child(Table* table, u_int32_t page_num, u_int32_t index) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    u_int32_t num_keys = *internal_node_num_keys(node);
+
+    *internal_node_child(node, index + 1) = *internal_node_child(node, index);
+    *internal_node_child_count(node, index + 1) += *internal_node_child_count(node, index);
+    for (u_int32_t i = index; i + 1 < num_keys; i++) {
+        memcpy(internal_node_cell(node, i), internal_node_cell(node, i + 1), INTERNAL_NODE_CELL_SIZE);
+    }
+    *internal_node_num_keys(node) = num_keys - 1;
+
+    mark_page_dirty(pager, page_num);
+    unpin_page(pager, page_num);
+    internal_node_rebalance(table, page_num);
+}
+
+// merges or evens out the two leaves at index and index + 1 of the parent
+void leaf_nodes_rebalance(Table* table, u_int32_t parent_page_num, u_int32_t index) {
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    u_int32_t left_page_num = *internal_node_child(parent, index);
+    u_int32_t right_page_num = *internal_node_child(parent, index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+
+    if (leaf_node_used_bytes(left) + leaf_node_used_bytes(right) <= LEAF_NODE_SPACE_FOR_CELLS) {
+        u_int32_t left_cells = *leaf_node_num_cells(left);
+        u_int32_t right_cells = *leaf_node_num_cells(right);
+        for (u_int32_t i = 0; i < right_cells; i++) {
+            void* record = leaf_node_value(right, i);
+            leaf_node_insert_record(left, left_cells + i, *leaf_node_key(right, i), record, encoded_row_size(record));
+        }
+        *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+        mark_page_dirty(pager, left_page_num);
+        unpin_page(pager, left_page_num);
+        unpin_page(pager, right_page_num);
+        unpin_page(pager, parent_page_num);
+
+        free_page(pager, right_page_num);
+        internal_node_remove_child(table, parent_page_num, index);
+        return;
+    }
+
+    // too much for one page. line up the cells of both from copies and deal them out again
+    u_int8_t left_copy[PAGE_SIZE];
+    u_int8_t right_copy[PAGE_SIZE];
+    memcpy(left_copy, left, PAGE_SIZE);
+    memcpy(right_copy, right, PAGE_SIZE);
+    u_int32_t left_cells = *leaf_node_num_cells(left_copy);
+    u_int32_t num_cells = left_cells + *leaf_node_num_cells(right_copy);
+    u_int32_t keys[num_cells];
+    void* records[num_cells];
+    u_int32_t sizes[num_cells];
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        void* source = i < left_cells ? left_copy : right_copy;
+        u_int32_t cell_num = i < left_cells ? i : i - left_cells;
+        keys[i] = *leaf_node_key(source, cell_num);
+        records[i] = leaf_node_value(source, cell_num);
+        sizes[i] = encoded_row_size(records[i]);
+    }
+
+    *internal_node_key(parent, index) = leaf_nodes_fill(left, right, num_cells, keys, records, sizes, 50);
+    *internal_node_child_count(parent, index) = *leaf_node_num_cells(left);
+    *internal_node_child_count(parent, index + 1) = *leaf_node_num_cells(right);
+    mark_page_dirty(pager, left_page_num);
+    mark_page_dirty(pager, right_page_num);
+    mark_page_dirty(pager, parent_page_num);
+    unpin_page(pager, left_page_num);
+    unpin_page(pager, right_page_num);
+    unpin_page(pager, parent_page_num);
+}
+
+// merges or evens out the two internal nodes at index and index + 1 of the parent. the parent's separator between them comes
+// down as the key of the left node's right child
+void internal_nodes_rebalance(Table* table, u_int32_t parent_page_num, u_int32_t index) {
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    u_int32_t separator = *internal_node_key(parent, index);
+    u_int32_t left_page_num = *internal_node_child(parent, index);
+    u_int32_t right_page_num = *internal_node_child(parent, index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+
+    u_int32_t left_keys = *internal_node_num_keys(left);
+    u_int32_t right_keys = *internal_node_num_keys(right);
+    u_int32_t count = left_keys + right_keys + 2;
+    u_int32_t* children = malloc(count * sizeof(u_int32_t));
+    u_int32_t* keys = malloc((count - 1) * sizeof(u_int32_t));
+    u_int32_t* counts = malloc(count * sizeof(u_int32_t));
+    for (u_int32_t i = 0; i <= left_keys; i++) {
+        children[i] = *internal_node_child(left, i);
+        counts[i] = *internal_node_child_count(left, i);
+        keys[i] = i < left_keys ? *internal_node_key(left, i) : separator;
+    }
+    for (u_int32_t i = 0; i <= right_keys; i++) {
+        children[left_keys + 1 + i] = *internal_node_child(right, i);
+        counts[left_keys + 1 + i] = *internal_node_child_count(right, i);
+        if (i < right_keys) {
+            keys[left_keys + 1 + i] = *internal_node_key(right, i);
+        }
+    }
+
+    // a merge puts everything on the left page, otherwise both get half
+    bool merge = count <= INTERNAL_NODE_MAX_KEYS + 1;
+    u_int32_t left_children = merge ? count : count / 2;
+    *internal_node_num_keys(left) = left_children - 1;
+    for (u_int32_t i = 0; i < left_children - 1; i++) {
+        *internal_node_child(left, i) = children[i];
+        *internal_node_key(left, i) = keys[i];
+        *internal_node_child_count(left, i) = counts[i];
+    }
+    *internal_node_right_child(left) = children[left_children - 1];
+    *internal_node_child_count(left, left_children - 1) = counts[left_children - 1];
+    mark_page_dirty(pager, left_page_num);
+
+    if (!merge) {
+        *internal_node_num_keys(right) = count - left_children - 1;
+        for (u_int32_t i = left_children; i < count - 1; i++) {
+            *internal_node_child(right, i - left_children) = children[i];
+            *internal_node_key(right, i - left_children) = keys[i];
+            *internal_node_child_count(right, i - left_children) = counts[i];
+        }
+        *internal_node_right_child(right) = children[count - 1];
+        *internal_node_child_count(right, count - left_children - 1) = counts[count - 1];
+        *internal_node_key(parent, index) = keys[left_children - 1];
+        *internal_node_child_count(parent, index) = node_row_count(left);
+        *internal_node_child_count(parent, index + 1) = node_row_count(right);
+        mark_page_dirty(pager, right_page_num);
+        mark_page_dirty(pager, parent_page_num);
+    }
+
+    // only the children between the old and the new boundary changed sides
+    u_int32_t first_moved = left_keys + 1 < left_children ? left_keys + 1 : left_children;
+    u_int32_t end_moved = left_keys + 1 < left_children ? left_children : left_keys + 1;
+    for (u_int32_t i = first_moved; i < end_moved; i++) {
+        set_node_parent(pager, children[i], i < left_children ? left_page_num : right_page_num);
+    }
+    free(children);
+    free(keys);
+    free(counts);
+
+    unpin_page(pager, left_page_num);
+    unpin_page(pager, right_page_num);
+    unpin_page(pager, parent_page_num);
+    if (merge) {
+        free_page(pager, right_page_num);
+        internal_node_remove_child(table, parent_page_num, index);
+    }
+}
+
+// called after an internal node lost a child. the root only needs fixing once it's down to one child, which then takes its place
+void internal_node_rebalance(Table* table, u_int32_t page_num) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    u_int32_t num_keys = *internal_node_num_keys(node);
+
+    if (is_node_root(node)) {
+        if (num_keys == 0) {
+            u_int32_t child_page_num = *internal_node_right_child(node);
+            void* child = get_page(pager, child_page_num);
+            memcpy(node, child, PAGE_SIZE);
+            set_node_root(node, true);
+            *node_parent(node) = 0;
+            if (get_node_type(node) == NODE_INTERNAL) {
+                for (u_int32_t i = 0; i <= *internal_node_num_keys(node); i++) {
+                    set_node_parent(pager, *internal_node_child(node, i), page_num);
+                }
+            }
+            mark_page_dirty(pager, page_num);
+            unpin_page(pager, child_page_num);
+            unpin_page(pager, page_num);
+            free_page(pager, child_page_num);
+            return;
+        }
+        unpin_page(pager, page_num);
+        return;
+    }
+
+    u_int32_t parent_page_num = *node_parent(node);
+    unpin_page(pager, page_num);
+    if (num_keys >= INTERNAL_NODE_MIN_KEYS) {
+        return;
+    }
+
+    void* parent = get_page(pager, parent_page_num);
+    u_int32_t index = internal_node_sibling_pair(parent, page_num);
+    unpin_page(pager, parent_page_num);
+    internal_nodes_rebalance(table, parent_page_num, index);
+}
+
+void index_remove_row(Table* table, Row* row);
+
+// removes the row with this key, if there is one. returns whether there was
+bool table_delete(Table* table, u_int32_t key) {
+    Pager* pager = table->pager;
+    Cursor* cursor = table_find(table, key);
+    u_int32_t page_num = cursor->page_num;
+
+    void* node = get_page(pager, page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == key;
+    Row row;
+    if (found) {
+        // the indexes need its values once it's gone
+        deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+        leaf_node_delete_cell(node, cursor->cell_num);
+        mark_page_dirty(pager, page_num);
+    }
+    bool underfull = found && !is_node_root(node) && leaf_node_used_bytes(node) < LEAF_NODE_MIN_BYTES;
+    u_int32_t parent_page_num = *node_parent(node);
+    unpin_page(pager, page_num);
+    close_cursor(cursor);
+    if (found) {
+        add_row_counts(pager, page_num, -1);
+        index_remove_row(table, &row);
+    }
+
+    if (underfull) {
+        void* parent = get_page(pager, parent_page_num);
+        u_int32_t index = internal_node_sibling_pair(parent, page_num);
+        unpin_page(pager, parent_page_num);
+        leaf_nodes_rebalance(table, parent_page_num, index);
+    }
+    return found;
+}
+
+/**
+ * Secondary indexes. create index on username (or email) builds a second B+tree in the file, keyed by the column's value and
+ * then the row's id, so every key is unique and rows with the same value sit next to each other in id order. Its root page
+ * is kept in the file header. Inserts, updates and deletes keep every index in step with the table within the same statement,
+ * and a select on the column walks the index leaves instead of the whole table.
+ * Index nodes split like the table's, but nothing is rebalanced after deletes: a leaf can end up empty and just stays in the
+ * chain. Its parent's key for it is still a correct upper bound, so searches aren't affected.
+ */
+
+// functions for reading and writing index nodes
+u_int32_t* index_node_num_cells(void* node) {
+    return node + INDEX_NODE_NUM_CELLS_OFFSET;
+}
+
+u_int32_t* index_node_link(void* node) {
+    return node + INDEX_NODE_LINK_OFFSET;
+}
+
+u_int32_t* index_node_content_start(void* node) {
+    return node + INDEX_NODE_CONTENT_START_OFFSET;
+}
+
+u_int16_t* index_node_slots(void* node) {
+    return node + INDEX_NODE_HEADER_SIZE;
+}
+
+bool is_index_leaf(void* node) {
+    return *((u_int8_t*)(node + NODE_TYPE_OFFSET)) == NODE_TYPE_BYTE_INDEX_LEAF;
+}
+
+void initialize_index_node(void* node, bool leaf) {
+    *((u_int8_t*)(node + NODE_TYPE_OFFSET)) = leaf ? NODE_TYPE_BYTE_INDEX_LEAF : NODE_TYPE_BYTE_INDEX_INTERNAL;
+    set_node_root(node, false);
+    *index_node_num_cells(node) = 0;
+    *index_node_link(node) = 0;
+    *index_node_content_start(node) = PAGE_SIZE;
+}
+
+// a key in an index. value isn't null terminated
+typedef struct {
+    const char* value;
+    u_int32_t length;
+    u_int32_t id;
+} IndexKey;
+
+void* index_entry(void* node, u_int32_t cell) {
+    return node + index_node_slots(node)[cell];
+}
+
+u_int32_t index_entry_child(void* node, u_int32_t cell) {
+    return *(u_int32_t*)index_entry(node, cell);
+}
+
+// the key of an encoded entry. internal entries have their child in front of it
+IndexKey index_entry_key(void* entry, bool leaf) {
+    u_int8_t* bytes = leaf ? entry : entry + INDEX_ENTRY_CHILD_SIZE;
+    IndexKey key;
+    memcpy(&key.id, bytes, INDEX_ENTRY_ID_SIZE);
+    key.length = bytes[INDEX_ENTRY_ID_SIZE];
+    key.value = (char*)bytes + INDEX_ENTRY_ID_SIZE + INDEX_ENTRY_LENGTH_SIZE;
+    return key;
+}
+
+u_int32_t index_entry_size(void* entry, bool leaf) {
+    IndexKey key = index_entry_key(entry, leaf);
+    return (leaf ? 0 : INDEX_ENTRY_CHILD_SIZE) + INDEX_ENTRY_ID_SIZE + INDEX_ENTRY_LENGTH_SIZE + key.length;
+}
+
+// writes the entry for key into destination and returns its size. child only goes into internal entries
+u_int32_t index_encode_entry(u_int8_t* destination, bool leaf, u_int32_t child, IndexKey* key) {
+    u_int8_t* bytes = destination;
+    if (!leaf) {
+        memcpy(bytes, &child, INDEX_ENTRY_CHILD_SIZE);
+        bytes += INDEX_ENTRY_CHILD_SIZE;
+    }
+    memcpy(bytes, &key->id, INDEX_ENTRY_ID_SIZE);
+    bytes += INDEX_ENTRY_ID_SIZE;
+    *bytes++ = key->length;
+    memcpy(bytes, key->value, key->length);
+    return bytes + key->length - destination;
+}
+
+// orders keys by value (bytewise, a prefix first) and then by id
+int compare_index_keys(IndexKey* a, IndexKey* b) {
+    int result = memcmp(a->value, b->value, a->length < b->length ? a->length : b->length);
+    if (result != 0) {
+        return result;
+    }
+    if (a->length != b->length) {
+        return a->length < b->length ? -1 : 1;
+    }
+    if (a->id != b->id) {
+        return a->id < b->id ? -1 : 1;
+    }
+    return 0;
+}
+
+// the first cell whose key isn't smaller than key, or num_cells if there is none
+u_int32_t index_node_lower_bound(void* node, IndexKey* key) {
+    bool leaf = is_index_leaf(node);
+    u_int32_t min_index = 0;
+    u_int32_t max_index = *index_node_num_cells(node);
+    while (min_index != max_index) {
+        u_int32_t index = (min_index + max_index) / 2;
+        IndexKey cell_key = index_entry_key(index_entry(node, index), leaf);
+        if (compare_index_keys(&cell_key, key) >= 0) {
+            max_index = index;
+        } else {
+            min_index = index + 1;
+        }
+    }
+    return min_index;
+}
+
+// puts an encoded entry in at cell. returns false if the node doesn't have room for it
+bool index_node_insert_entry(void* node, u_int32_t cell, void* entry, u_int32_t size) {
+    u_int32_t num_cells = *index_node_num_cells(node);
+    u_int32_t slots_end = INDEX_NODE_HEADER_SIZE + (num_cells + 1) * INDEX_NODE_SLOT_SIZE;
+    if (slots_end + size > *index_node_content_start(node)) {
+        return false;
+    }
+
+    u_int32_t content_start = *index_node_content_start(node) - size;
+    memcpy(node + content_start, entry, size);
+    *index_node_content_start(node) = content_start;
+    u_int16_t* slots = index_node_slots(node);
+    memmove(slots + cell + 1, slots + cell, (num_cells - cell) * INDEX_NODE_SLOT_SIZE);
+    slots[cell] = content_start;
+    *index_node_num_cells(node) = num_cells + 1;
+    return true;
+}
+
+// takes the entry at cell out, and packs the rest against the end of the page again
+void index_node_remove_entry(void* node, u_int32_t cell) {
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    bool leaf = is_index_leaf(node);
+    u_int32_t num_cells = *index_node_num_cells(copy);
+
+    *index_node_num_cells(node) = 0;
+    *index_node_content_start(node) = PAGE_SIZE;
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        if (i != cell) {
+            void* entry = index_entry(copy, i);
+            index_node_insert_entry(node, *index_node_num_cells(node), entry, index_entry_size(entry, leaf));
+        }
+    }
+}
+
+void set_index_root(Table* table, IndexColumn column, u_int32_t page_num) {
+    // readers look at this without the writer's lock, see index_find_leaf()
+    __atomic_store_n(&table->index_roots[column], page_num, __ATOMIC_RELEASE);
+    void* header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+    *db_header_index_root(header, column) = page_num;
+    mark_page_dirty(table->pager, DB_HEADER_PAGE_NUM);
+    unpin_page(table->pager, DB_HEADER_PAGE_NUM);
+}
+
+// the index leaf where key belongs. each internal node sends it to the first child whose biggest key isn't smaller, or to
+// the right child. a reader crabs down and gets the leaf back latched. a root that splits moves to a new page, which the
+// writer points index_roots at before it lets go of the old one, so a reader checks it latched the current root
+u_int32_t index_find_leaf(Table* table, IndexColumn column, IndexKey* key) {
+    Pager* pager = table->pager;
+    u_int32_t page_num;
+    while (true) {
+        page_num = __atomic_load_n(&table->index_roots[column], __ATOMIC_ACQUIRE);
+        latch_page(pager, page_num);
+        if (page_num == __atomic_load_n(&table->index_roots[column], __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        unlatch_page(pager, page_num);
+    }
+
+    while (true) {
+        void* node = get_page(pager, page_num);
+        if (is_index_leaf(node)) {
+            unpin_page(pager, page_num);
+            return page_num;
+        }
+        u_int32_t cell = index_node_lower_bound(node, key);
+        u_int32_t child_page_num = cell < *index_node_num_cells(node) ? index_entry_child(node, cell) : *index_node_link(node);
+        unpin_page(pager, page_num);
+        if (!latch_child(pager, page_num, child_page_num)) {
+            return index_find_leaf(table, column, key);
+        }
+        page_num = child_page_num;
+    }
+}
+
+void index_node_insert(Table* table, IndexColumn column, u_int32_t page_num, u_int32_t cell, void* entry, u_int32_t size);
+
+// a child of this internal node just split. left_page_num kept the lower half, which ends at separator, and right_page_num took
+// over the child's place (and its old biggest key). the parent's link to it moves to the right half, and left gets a new entry
+void index_internal_insert_child(Table* table, IndexColumn column, u_int32_t page_num, u_int32_t left_page_num,
+                                 u_int32_t right_page_num, IndexKey* separator) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    u_int32_t num_cells = *index_node_num_cells(node);
+    u_int32_t cell = num_cells;
+    if (*index_node_link(node) == left_page_num) {
+        *index_node_link(node) = right_page_num;
+    } else {
+        cell = 0;
+        while (index_entry_child(node, cell) != left_page_num) {
+            cell++;
+        }
+        memcpy(index_entry(node, cell), &right_page_num, INDEX_ENTRY_CHILD_SIZE);
+    }
+    mark_page_dirty(pager, page_num);
+    unpin_page(pager, page_num);
+
+    u_int8_t entry[INDEX_ENTRY_MAX_SIZE];
+    u_int32_t size = index_encode_entry(entry, false, left_page_num, separator);
+    index_node_insert(table, column, page_num, cell, entry, size);
+}
+
+/**
+ * Inserts an encoded entry into an index node at cell. A full node splits: the entries, new one included, are divided by bytes
+ * between the old page and a new one to its right. In an internal node the last entry of the left half turns into the left
+ * page's right child. Either way the left half's biggest key is the separator that goes up into the parent, or into a new root
+ * that the file header then points at.
+ */
+void index_node_insert(Table* table, IndexColumn column, u_int32_t page_num, u_int32_t cell, void* entry, u_int32_t size) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    if (index_node_insert_entry(node, cell, entry, size)) {
+        mark_page_dirty(pager, page_num);
+        unpin_page(pager, page_num);
+        return;
+    }
+
+    // line up every entry from a copy, since the node gets rebuilt
+    u_int8_t copy[PAGE_SIZE];
+    memcpy(copy, node, PAGE_SIZE);
+    bool leaf = is_index_leaf(copy);
+    u_int32_t num_entries = *index_node_num_cells(copy) + 1;
+    void* entries[num_entries];
+    u_int32_t sizes[num_entries];
+    u_int32_t total_bytes = 0;
+    for (u_int32_t i = 0, source = 0; i < num_entries; i++) {
+        if (i == cell) {
+            entries[i] = entry;
+            sizes[i] = size;
+        } else {
+            entries[i] = index_entry(copy, source++);
+            sizes[i] = index_entry_size(entries[i], leaf);
+        }
+        total_bytes += INDEX_NODE_SLOT_SIZE + sizes[i];
+    }
+    u_int32_t left_count = 0;
+    u_int32_t left_bytes = 0;
+    while (left_count < num_entries - 1 && left_bytes < total_bytes / 2) {
+        left_bytes += INDEX_NODE_SLOT_SIZE + sizes[left_count];
+        left_count++;
+    }
+    IndexKey separator = index_entry_key(entries[left_count - 1], leaf);
+
+    u_int32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    initialize_index_node(new_node, leaf);
+    *node_parent(new_node) = *node_parent(copy);
+    initialize_index_node(node, leaf);
+    for (u_int32_t i = 0; i < num_entries; i++) {
+        if (i >= left_count) {
+            index_node_insert_entry(new_node, i - left_count, entries[i], sizes[i]);
+        } else if (!leaf && i == left_count - 1) {
+            *index_node_link(node) = *(u_int32_t*)entries[i];
+        } else {
+            index_node_insert_entry(node, i, entries[i], sizes[i]);
+        }
+    }
+    *index_node_link(new_node) = *index_node_link(copy);
+    if (leaf) {
+        *index_node_link(node) = new_page_num;
+    } else {
+        // every child that moved needs to know its new parent
+        for (u_int32_t i = 0; i < *index_node_num_cells(new_node); i++) {
+            set_node_parent(pager, index_entry_child(new_node, i), new_page_num);
+        }
+        set_node_parent(pager, *index_node_link(new_node), new_page_num);
+    }
+    mark_page_dirty(pager, page_num);
+    mark_page_dirty(pager, new_page_num);
+    unpin_page(pager, new_page_num);
+    unpin_page(pager, page_num);
+
+    if (!is_node_root(copy)) {
+        index_internal_insert_child(table, column, *node_parent(copy), page_num, new_page_num, &separator);
+        return;
+    }
+
+    // the header says where the root is, so unlike the table's, a new root can go on any page
+    u_int32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page(pager, root_page_num);
+    initialize_index_node(root, false);
+    set_node_root(root, true);
+    *node_parent(root) = 0;
+    u_int8_t root_entry[INDEX_ENTRY_MAX_SIZE];
+    index_node_insert_entry(root, 0, root_entry, index_encode_entry(root_entry, false, page_num, &separator));
+    *index_node_link(root) = new_page_num;
+    mark_page_dirty(pager, root_page_num);
+    unpin_page(pager, root_page_num);
+    set_node_parent(pager, page_num, root_page_num);
+    set_node_parent(pager, new_page_num, root_page_num);
+    set_index_root(table, column, root_page_num);
+}
+
+// the key a row has in the index on column
+IndexKey index_key_for_row(IndexColumn column, Row* row) {
+    IndexKey key;
+    key.value = column == INDEX_USERNAME ? row->username : row->email;
+    key.length = strlen(key.value);
+    key.id = row->id;
+    return key;
+}
+
+void index_insert(Table* table, IndexColumn column, IndexKey* key) {
+    u_int32_t page_num = index_find_leaf(table, column, key);
+    void* node = get_page(table->pager, page_num);
+    u_int32_t cell = index_node_lower_bound(node, key);
+    unpin_page(table->pager, page_num);
+
+    u_int8_t entry[INDEX_ENTRY_MAX_SIZE];
+    u_int32_t size = index_encode_entry(entry, true, 0, key);
+    index_node_insert(table, column, page_num, cell, entry, size);
+}
+
+void index_delete(Table* table, IndexColumn column, IndexKey* key) {
+    u_int32_t page_num = index_find_leaf(table, column, key);
+    void* node = get_page(table->pager, page_num);
+    u_int32_t cell = index_node_lower_bound(node, key);
+    if (cell < *index_node_num_cells(node)) {
+        IndexKey found = index_entry_key(index_entry(node, cell), true);
+        if (compare_index_keys(&found, key) == 0) {
+            index_node_remove_entry(node, cell);
+            mark_page_dirty(table->pager, page_num);
+        }
+    }
+    unpin_page(table->pager, page_num);
+}
+
+// adds a new row to every index there is
+void index_add_row(Table* table, Row* row) {
+    for (u_int32_t column = 0; column < NUM_INDEX_COLUMNS; column++) {
+        if (table->index_roots[column] != 0) {
+            IndexKey key = index_key_for_row(column, row);
+            index_insert(table, column, &key);
+        }
+    }
+}
+
+// takes a row that's going away out of every index there is
+void index_remove_row(Table* table, Row* row) {
+    for (u_int32_t column = 0; column < NUM_INDEX_COLUMNS; column++) {
+        if (table->index_roots[column] != 0) {
+            IndexKey key = index_key_for_row(column, row);
+            index_delete(table, column, &key);
+        }
+    }
+}
+
+int compare_index_key_pointers(const void* a, const void* b) {
+    return compare_index_keys(*(IndexKey**)a, *(IndexKey**)b);
+}
+
+// fills an empty index from the rows already in the table. the keys are sorted first, so the index is built left to right
+void index_build(Table* table, IndexColumn column) {
+    u_int32_t num_rows = table_num_rows(table);
+    if (num_rows == 0) {
+        return;
+    }
+
+    // the values are copied out back to back. the arena moves while it grows, so keys only point into it once it's done
+    IndexKey* keys = malloc(num_rows * sizeof(IndexKey));
+    size_t* offsets = malloc(num_rows * sizeof(size_t));
+    size_t values_length = 0;
+    size_t values_capacity = 1 << 16;
+    char* values = malloc(values_capacity);
+    Row row;
+    Cursor* cursor = table_start(table);
+    for (u_int32_t i = 0; i < num_rows; i++) {
+        deserialize_row(cursor_value(cursor), &row);
+        keys[i] = index_key_for_row(column, &row);
+        while (values_length + keys[i].length > values_capacity) {
+            values_capacity *= 2;
+            values = realloc(values, values_capacity);
+        }
+        memcpy(values + values_length, keys[i].value, keys[i].length);
+        offsets[i] = values_length;
+        values_length += keys[i].length;
+        cursor_advance(cursor);
+    }
+    close_cursor(cursor);
+
+    IndexKey** sorted = malloc(num_rows * sizeof(IndexKey*));
+    for (u_int32_t i = 0; i < num_rows; i++) {
+        keys[i].value = values + offsets[i];
+        sorted[i] = &keys[i];
+    }
+    qsort(sorted, num_rows, sizeof(IndexKey*), compare_index_key_pointers);
+    for (u_int32_t i = 0; i < num_rows; i++) {
+        index_insert(table, column, sorted[i]);
+    }
+    free(keys);
+    free(offsets);
+    free(values);
+    free(sorted);
+}
+
+/**
+ * Bulk loading. Instead of one insert (search, shift, split) per row, .load builds the tree bottom-up: rows fill leaves left to
+ * right up to the fill factor, and every finished node hands its page number and max key to the open node one level up.
+ * Rows vary in size, so leaves are filled by bytes; a planning pass over the sorted rows (see BulkPlan) counts the leaves
+ * before building starts. From there on every internal level knows how many nodes it gets and spreads its entries evenly
+ * over them (no half empty node at the right edge).
+ *
+ * Pages below the root skip the log. They go straight to the database file and are checkpointed before the root page is
+ * replaced through a normal logged commit, so a crash in the middle of a load leaves the old (empty) table plus some unused pages.
+ */
+typedef struct {
+    u_int32_t page_num;
+    void* node;             // the open node. a pinned page, or for the root a private buffer that goes to the root page at the end
+    bool open;
+    u_int32_t count;        // cells (leaf level) or children (internal levels) in the open node
+    u_int32_t target;       // how many the open node gets before it's closed
+    u_int32_t node_index;   // which node of this level is open
+    u_int32_t num_nodes;
+    u_int32_t num_items;    // cells or children spread over the whole level
+} BulkLevel;
+
+// packs sorted rows into leaves of at most leaf_bytes (slots plus records), the same way for planning and for building
+typedef struct {
+    u_int32_t leaf_bytes;
+    u_int32_t used;         // bytes taken in the current leaf
+    u_int32_t num_leaves;
+} BulkPlan;
+
+void bulk_plan_init(BulkPlan* plan, Table* table) {
+    plan->leaf_bytes = LEAF_NODE_SPACE_FOR_CELLS * table->fill_factor / 100;
+    plan->used = 0;
+    plan->num_leaves = 0;
+}
+
+// returns true if the row starts a new leaf. a leaf always takes at least one row, whatever the fill factor
+bool bulk_plan_row(BulkPlan* plan, Row* row) {
+    u_int8_t record[ROW_SIZE];
+    u_int32_t cost = LEAF_NODE_SLOT_SIZE + serialize_row(row, record);
+    if (plan->num_leaves == 0 || plan->used + cost > plan->leaf_bytes) {
+        plan->num_leaves += 1;
+        plan->used = cost;
+        return true;
+    }
+    plan->used += cost;
+    return false;
+}
+
+typedef struct {
+    Table* table;
+    u_int32_t num_levels;   // level 0 holds the leaves, the last level is the root
+    BulkLevel levels[BULK_MAX_LEVELS];
+    BulkPlan leaf_plan;     // replays the planning pass to decide where each leaf ends
+    u_int32_t last_key;     // key of the last row added, the max key of the open leaf
+} BulkLoader;
+
+void bulk_loader_init(BulkLoader* loader, Table* table, u_int32_t num_leaves) {
+    u_int32_t internal_children = (INTERNAL_NODE_MAX_KEYS + 1) * table->fill_factor / 100;
+    if (internal_children < 2) {
+        internal_children = 2;
+    }
+
+    loader->table = table;
+    loader->num_levels = 0;
+    bulk_plan_init(&loader->leaf_plan, table);
+
+    // the leaf level was planned already, only its node count matters here
+    BulkLevel* leaves = &loader->levels[loader->num_levels++];
+    leaves->open = false;
+    leaves->node_index = 0;
+    leaves->num_items = 0;
+    leaves->num_nodes = num_leaves;
+    u_int32_t num_items = num_leaves;
+    while (num_items > 1) {
+        BulkLevel* level = &loader->levels[loader->num_levels++];
+        level->open = false;
+        level->node_index = 0;
+        level->num_items = num_items;
+        level->num_nodes = (num_items + internal_children - 1) / internal_children;
+        num_items = level->num_nodes;
+    }
+
+    table->pager->bulk_loading = true;
+}
+
+void bulk_open_node(BulkLoader* loader, u_int32_t level_num) {
+    Pager* pager = loader->table->pager;
+    BulkLevel* level = &loader->levels[level_num];
+    bool is_root = level_num == loader->num_levels - 1;
+
+    if (is_root) {
+        // the root keeps its page number, and that page is only touched once everything below it is on disk
+        level->page_num = loader->table->root_page_num;
+        level->node = calloc(1, PAGE_SIZE);
+    } else {
+        // always appended, even if the freelist has pages, so the next leaf's page number is known before it's opened
+        level->page_num = pager->num_pages;
+        level->node = get_page(pager, level->page_num);
+    }
+    if (level_num == 0) {
+        initialize_leaf_node(level->node);
+    } else {
+        initialize_internal_node(level->node);
+    }
+    set_node_root(level->node, is_root);
+
+    // spread the level's entries evenly, the first few nodes take one extra each. leaves are closed by bytes instead
+    level->count = 0;
+    if (level_num > 0) {
+        level->target = level->num_items / level->num_nodes + (level->node_index < level->num_items % level->num_nodes ? 1 : 0);
+    }
+    level->open = true;
+}
+
+void bulk_close_node(BulkLoader* loader, u_int32_t level_num, u_int32_t max_key);
+
+// appends a finished child (with child_count rows below it) to the open node on this level and returns the page it went to
+u_int32_t bulk_add_child(BulkLoader* loader, u_int32_t level_num, u_int32_t child_page_num, u_int32_t child_max_key,
+                         u_int32_t child_count) {
+    BulkLevel* level = &loader->levels[level_num];
+    if (!level->open) {
+        bulk_open_node(loader, level_num);
+    }
+    u_int32_t page_num = level->page_num;
+
+    if (level->count + 1 < level->target) {
+        *internal_node_num_keys(level->node) = level->count + 1;
+        *internal_node_child(level->node, level->count) = child_page_num;
+        *internal_node_key(level->node, level->count) = child_max_key;
+    } else {
+        *internal_node_right_child(level->node) = child_page_num;
+    }
+    *internal_node_child_count(level->node, level->count) = child_count;
+    level->count += 1;
+
+    if (level->count == level->target) {
+        bulk_close_node(loader, level_num, child_max_key);
+    }
+    return page_num;
+}
+
+// the open node on this level is full. link it into its parent and let go of it
+void bulk_close_node(BulkLoader* loader, u_int32_t level_num, u_int32_t max_key) {
+    Pager* pager = loader->table->pager;
+    BulkLevel* level = &loader->levels[level_num];
+    level->open = false;
+    if (level_num == loader->num_levels - 1) {
+        return;
+    }
+
+    *node_parent(level->node) = bulk_add_child(loader, level_num + 1, level->page_num, max_key, node_row_count(level->node));
+    if (level_num == 0 && level->node_index + 1 < level->num_nodes) {
+        // nothing gets allocated until the next leaf opens, so it will take the next page at the end of the file
+        *leaf_node_next_leaf(level->node) = pager->num_pages;
+    }
+    mark_page_dirty(pager, level->page_num);
+    unpin_page(pager, level->page_num);
+    level->node_index += 1;
+}
+
+// rows have to come in strictly increasing key order
+void bulk_loader_add(BulkLoader* loader, Row* row) {
+    BulkLevel* leaf = &loader->levels[0];
+    if (bulk_plan_row(&loader->leaf_plan, row) && leaf->open) {
+        bulk_close_node(loader, 0, loader->last_key);
+    }
+    if (!leaf->open) {
+        bulk_open_node(loader, 0);
+    }
+
+    u_int8_t record[ROW_SIZE];
+    u_int32_t size = serialize_row(row, record);
+    leaf_node_insert_record(leaf->node, leaf->count, row->id, record, size);
+    leaf->count += 1;
+    loader->last_key = row->id;
+}
+
+void bulk_loader_finish(BulkLoader* loader) {
+    Pager* pager = loader->table->pager;
+    BulkLevel* top = &loader->levels[loader->num_levels - 1];
+
+    if (loader->levels[0].open) {
+        bulk_close_node(loader, 0, loader->last_key);
+    }
+    pager_checkpoint(pager);
+    pager->bulk_loading = false;
+
+    void* root = get_page(pager, top->page_num);
+    memcpy(root, top->node, PAGE_SIZE);
+    mark_page_dirty(pager, top->page_num);
+    unpin_page(pager, top->page_num);
+    free(top->node);
+    pager_commit(pager);
+}
+
+/**
+ * Reads one field of a csv row from *position into destination, which takes up to max_length characters and a terminator. A
+ * field in double quotes can hold commas, quotes (written twice) and line breaks, which is how .export writes any field that
+ * has them. A quote anywhere but at the start of a field is just a character. The field has to be followed by a comma, or by
+ * the end of the row if it's the last one, and *position is left right after that. Returns false if it isn't, if a quote
+ * doesn't close, or if the field is too long.
+ */
+bool parse_csv_field(char** position, char* destination, u_int32_t max_length, bool last) {
+    char* source = *position;
+    u_int32_t length = 0;
+    if (*source == '"') {
+        source++;
+        while (true) {
+            if (*source == '\0') {
+                return false;
+            }
+            if (*source == '"') {
+                if (source[1] != '"') {
+                    source++;
+                    break;
+                }
+                source++;
+            }
+            if (length == max_length) {
+                return false;
+            }
+            destination[length++] = *source++;
+        }
+    } else {
+        while (*source != ',' && *source != '\0') {
+            if (length == max_length) {
+                return false;
+            }
+            destination[length++] = *source++;
+        }
+    }
+    destination[length] = '\0';
+
+    if (last) {
+        return *source == '\0';
+    }
+    if (*source != ',') {
+        return false;
+    }
+    *position = source + 1;
+    return true;
+}
+
+// whether a csv row ends inside a quoted field, i.e. a line break in that field cut it short and it goes on on the next line
+bool csv_row_open(const char* line) {
+    bool in_quotes = false;
+    bool field_start = true;
+    for (const char* c = line; *c != '\0'; c++) {
+        if (in_quotes) {
+            if (*c == '"' && c[1] == '"') {
+                c++;
+            } else if (*c == '"') {
+                in_quotes = false;
+            }
+        } else {
+            in_quotes = field_start && *c == '"';
+            field_start = *c == ',';
+        }
+    }
+    return in_quotes;
+}
+
+// parses one "id,username,email" row of a .load file
+bool parse_load_row(char* line, Row* row) {
+    // only the line break that ends the row goes, a quoted field may hold more of them
+    size_t line_length = strlen(line);
+    while (line_length > 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')) {
+        line[--line_length] = '\0';
+    }
+
+    char id_field[16];
+    char* position = line;
+    if (!parse_csv_field(&position, id_field, sizeof(id_field) - 1, false)
+        || !parse_csv_field(&position, row->username, COLUMN_USERNAME_SIZE, false)
+        || !parse_csv_field(&position, row->email, COLUMN_EMAIL_SIZE, true)) {
+        return false;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long id = strtoul(id_field, &end, 10);
+    if (end == id_field || *end != '\0' || id_field[0] == '-' || errno != 0 || id > UINT32_MAX) {
+        return false;
+    }
+    row->id = id;
+    return true;
+}
+
+/**
+ * A binary export is a small header followed by fixed width records, ROW_SIZE bytes each: the id, then the username and the
+ * email padded out with zeros to their full column size (the way rows were laid out on disk before leaves were slotted).
+ */
+#define EXPORT_BINARY_MAGIC "mdbrows\0"
+const u_int32_t EXPORT_BINARY_MAGIC_SIZE = 8;
+const u_int32_t EXPORT_BINARY_VERSION = 1;
+const u_int32_t EXPORT_BINARY_HEADER_SIZE = 16;    // magic | version | record size
+
+// the rows of a .load file, which is either "id,username,email" lines or a binary export
+typedef struct {
+    FILE* file;
+    bool binary;
+    u_int32_t record_size;  // what the binary header says. anything but ROW_SIZE can't be read
+    char* line;
+    size_t line_capacity;
+} LoadInput;
+
+bool load_input_open(LoadInput* input, const char* filename) {
+    input->file = fopen(filename, "r");
+    if (input->file == NULL) {
+        return false;
+    }
+    input->line = NULL;
+    input->line_capacity = 0;
+
+    u_int8_t header[EXPORT_BINARY_HEADER_SIZE];
+    input->binary = fread(header, 1, EXPORT_BINARY_HEADER_SIZE, input->file) == EXPORT_BINARY_HEADER_SIZE
+                    && memcmp(header, EXPORT_BINARY_MAGIC, EXPORT_BINARY_MAGIC_SIZE) == 0;
+    if (input->binary) {
+        u_int32_t version;
+        memcpy(&version, header + EXPORT_BINARY_MAGIC_SIZE, sizeof(u_int32_t));
+        memcpy(&input->record_size, header + EXPORT_BINARY_MAGIC_SIZE + sizeof(u_int32_t), sizeof(u_int32_t));
+        if (version != EXPORT_BINARY_VERSION) {
+            input->record_size = 0;
+        }
+    }
+    rewind(input->file);
+    return true;
+}
+
+// back to the first row
+void load_input_rewind(LoadInput* input) {
+    fseek(input->file, input->binary ? EXPORT_BINARY_HEADER_SIZE : 0, SEEK_SET);
+}
+
+// reads the next row into row. returns false at the end of the file, and sets *valid to whether the row made sense
+bool load_input_next(LoadInput* input, Row* row, bool* valid) {
+    if (!input->binary) {
+        ssize_t length = getline(&input->line, &input->line_capacity, input->file);
+        if (length == -1) {
+            return false;
+        }
+        // a quoted field can hold line breaks, and then the row goes on on the next line
+        char* more = NULL;
+        size_t more_capacity = 0;
+        ssize_t more_length;
+        while (csv_row_open(input->line) && (more_length = getline(&more, &more_capacity, input->file)) != -1) {
+            if ((size_t)(length + more_length + 1) > input->line_capacity) {
+                input->line_capacity = length + more_length + 1;
+                input->line = realloc(input->line, input->line_capacity);
+            }
+            memcpy(input->line + length, more, more_length + 1);
+            length += more_length;
+        }
+        free(more);
+        *valid = parse_load_row(input->line, row);
+        return true;
+    }
+
+    u_int8_t record[ROW_SIZE];
+    size_t bytes_read = fread(record, 1, ROW_SIZE, input->file);
+    if (bytes_read == 0) {
+        return false;
+    }
+    // the strings have to end inside their columns
+    *valid = bytes_read == ROW_SIZE && input->record_size == ROW_SIZE
+             && memchr(record + USERNAME_OFFSET, '\0', USERNAME_SIZE) != NULL
+             && memchr(record + EMAIL_OFFSET, '\0', EMAIL_SIZE) != NULL;
+    if (*valid) {
+        memcpy(&row->id, record + ID_OFFSET, ID_SIZE);
+        strcpy(row->username, (char*)record + USERNAME_OFFSET);
+        strcpy(row->email, (char*)record + EMAIL_OFFSET);
+    }
+    return true;
+}
+
+void load_input_close(LoadInput* input) {
+    free(input->line);
+    fclose(input->file);
+}
+
+int compare_row_ids(const void* a, const void* b) {
+    u_int32_t id_a = ((const Row*)a)->id;
+    u_int32_t id_b = ((const Row*)b)->id;
+    return (id_a > id_b) - (id_a < id_b);
+}
+
+// one sorted run of the external sort, spilled to a temporary file
+typedef struct {
+    FILE* file;
+    Row row;    // the smallest row of the run that hasn't been merged yet
+} SortRun;
+
+bool sort_run_next(SortRun* run) {
+    return fread(&run->row, sizeof(Row), 1, run->file) == 1;
+}
+
+// min-heap on the head row of each run, so merging k runs costs log k per row
+void sort_heap_sift_down(SortRun** heap, u_int32_t size, u_int32_t i) {
+    while (true) {
+        u_int32_t smallest = i;
+        u_int32_t left = 2 * i + 1;
+        u_int32_t right = left + 1;
+        if (left < size && heap[left]->row.id < heap[smallest]->row.id) {
+            smallest = left;
+        }
+        if (right < size && heap[right]->row.id < heap[smallest]->row.id) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        SortRun* swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+FILE* create_temp_file() {
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        printf("Error creating temporary file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+/**
+ * External merge sort for input that isn't in key order. The input is cut into runs of at most sort_memory bytes, each run is
+ * sorted in memory and spilled to a temporary file, and the runs are merged into one sorted file that then feeds the loader.
+ * Duplicates show up next to each other along the way, so they're caught before the tree is touched.
+ * If the whole input fits into a single run, nothing goes to disk at all.
+ */
+LoadResult bulk_load_unsorted(Table* table, LoadInput* input, u_int32_t num_rows) {
+    size_t run_capacity = table->sort_memory / sizeof(Row);
+    if (run_capacity < 1) {
+        run_capacity = 1;
+    }
+    if (run_capacity > num_rows) {
+        run_capacity = num_rows;
+    }
+    Row* rows = malloc(run_capacity * sizeof(Row));
+    SortRun* runs = NULL;
+    u_int32_t num_runs = 0;
+    bool valid;
+    BulkLoader loader;
+
+    load_input_rewind(input);
+    u_int32_t rows_read = 0;
+    while (rows_read < num_rows) {
+        u_int32_t count = 0;
+        // the first pass already checked every row
+        while (count < run_capacity && load_input_next(input, &rows[count], &valid)) {
+            count++;
+        }
+        rows_read += count;
+        qsort(rows, count, sizeof(Row), compare_row_ids);
+
+        if (num_runs == 0 && rows_read == num_rows) {
+            // everything fit in memory
+            for (u_int32_t i = 1; i < count; i++) {
+                if (rows[i].id == rows[i - 1].id) {
+                    free(rows);
+                    return LOAD_DUPLICATE_KEY;
+                }
+            }
+            BulkPlan plan;
+            bulk_plan_init(&plan, table);
+            for (u_int32_t i = 0; i < count; i++) {
+                bulk_plan_row(&plan, &rows[i]);
+            }
+            bulk_loader_init(&loader, table, plan.num_leaves);
+            for (u_int32_t i = 0; i < count; i++) {
+                bulk_loader_add(&loader, &rows[i]);
+            }
+            bulk_loader_finish(&loader);
+            free(rows);
+            return LOAD_SUCCESS;
+        }
+
+        FILE* run_file = create_temp_file();
+        if (fwrite(rows, sizeof(Row), count, run_file) != count) {
+            printf("Error writing temporary file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        rewind(run_file);
+        runs = realloc(runs, (num_runs + 1) * sizeof(SortRun));
+        runs[num_runs++].file = run_file;
+    }
+    free(rows);
+
+    // merge. only the head row of each run is in memory now
+    SortRun** heap = malloc(num_runs * sizeof(SortRun*));
+    u_int32_t heap_size = 0;
+    for (u_int32_t i = 0; i < num_runs; i++) {
+        if (sort_run_next(&runs[i])) {
+            heap[heap_size++] = &runs[i];
+        }
+    }
+    for (int32_t i = heap_size / 2 - 1; i >= 0; i--) {
+        sort_heap_sift_down(heap, heap_size, i);
+    }
+
+    FILE* sorted = create_temp_file();
+    LoadResult result = LOAD_SUCCESS;
+    BulkPlan plan;
+    bulk_plan_init(&plan, table);
+    bool have_last_key = false;
+    u_int32_t last_key = 0;
+    while (heap_size > 0) {
+        SortRun* run = heap[0];
+        if (have_last_key && run->row.id == last_key) {
+            result = LOAD_DUPLICATE_KEY;
+            break;
+        }
+        last_key = run->row.id;
+        have_last_key = true;
+        bulk_plan_row(&plan, &run->row);
+        if (fwrite(&run->row, sizeof(Row), 1, sorted) != 1) {
+            printf("Error writing temporary file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        if (!sort_run_next(run)) {
+            heap[0] = heap[--heap_size];
+        }
+        sort_heap_sift_down(heap, heap_size, 0);
+    }
+    for (u_int32_t i = 0; i < num_runs; i++) {
+        fclose(runs[i].file);
+    }
+    free(runs);
+    free(heap);
+
+    if (result == LOAD_SUCCESS) {
+        rewind(sorted);
+        bulk_loader_init(&loader, table, plan.num_leaves);
+        Row row;
+        while (fread(&row, sizeof(Row), 1, sorted) == 1) {
+            bulk_loader_add(&loader, &row);
+        }
+        bulk_loader_finish(&loader);
+    }
+    fclose(sorted);
+    return result;
+}
+
+/**
+ * Loads a file of "id,username,email" lines, or a binary export, into an empty table. A first pass checks every row and whether
+ * the keys are already sorted; sorted input is then streamed straight into the tree, anything else goes through
+ * bulk_load_unsorted(). line_num ends up as the number of rows read, which is the bad one for LOAD_INVALID_ROW.
+ */
+LoadResult table_bulk_load(Table* table, const char* filename, u_int32_t* line_num) {
+    *line_num = 0;
+
+    void* root = get_page(table->pager, table->root_page_num);
+    bool empty = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    unpin_page(table->pager, table->root_page_num);
+    if (!empty) {
+        return LOAD_TABLE_NOT_EMPTY;
+    }
+
+    LoadInput input;
+    if (!load_input_open(&input, filename)) {
+        return LOAD_CANT_OPEN_FILE;
+    }
+    load_input_rewind(&input);
+
+    Row row;
+    bool valid;
+    bool sorted = true;
+    u_int32_t num_rows = 0;
+    u_int32_t last_key = 0;
+    BulkPlan plan;  // only means something if the input turns out to be sorted
+    bulk_plan_init(&plan, table);
+    while (load_input_next(&input, &row, &valid)) {
+        *line_num += 1;
+        if (!valid) {
+            load_input_close(&input);
+            return LOAD_INVALID_ROW;
+        }
+        if (num_rows > 0 && row.id <= last_key) {
+            sorted = false;
+        }
+        last_key = row.id;
+        num_rows++;
+        bulk_plan_row(&plan, &row);
+    }
+
+    LoadResult result = LOAD_SUCCESS;
+    if (num_rows == 0) {
+        // nothing to do
+    } else if (sorted) {
+        BulkLoader loader;
+        bulk_loader_init(&loader, table, plan.num_leaves);
+        load_input_rewind(&input);
+        while (load_input_next(&input, &row, &valid)) {
+            bulk_loader_add(&loader, &row);
+        }
+        bulk_loader_finish(&loader);
+    } else {
+        result = bulk_load_unsorted(table, &input, num_rows);
+    }
+    load_input_close(&input);
+
+    // indexes created on the empty table are filled in once all the rows are there
+    if (result == LOAD_SUCCESS && num_rows > 0) {
+        for (u_int32_t column = 0; column < NUM_INDEX_COLUMNS; column++) {
+            if (table->index_roots[column] != 0) {
+                index_build(table, column);
+            }
+        }
+        pager_commit(table->pager);
+    }
+    return result;
+}
+
+/**
+ * Exporting. .export walks the leaf chain and formats rows straight out of the leaf cells into a big buffer, which goes out
+ * with a single write() each time it fills up. There's no Row copy or printf per row, so a dump runs about as fast as the disk
+ * takes it. csv writes the "id,username,email" lines .load reads, binary writes the fixed width records described above
+ * EXPORT_BINARY_MAGIC, which .load reads back as well.
+ */
+typedef enum {
+    EXPORT_CSV,
+    EXPORT_BINARY
+} ExportFormat;
+
+// the most a csv line can take: a 10 digit id, both strings at full length and quoted with every character a quote, two
+// commas and the newline
+const u_int32_t EXPORT_MAX_LINE_SIZE = 10 + 1 + 2 * COLUMN_USERNAME_SIZE + 2 + 1 + 2 * COLUMN_EMAIL_SIZE + 2 + 1;
+
+void export_write(int file_descriptor, void* buffer, size_t length) {
+    while (length > 0) {
+        ssize_t bytes_written = write(file_descriptor, buffer, length);
+        if (bytes_written == -1) {
+            printf("Error writing export: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        buffer += bytes_written;
+        length -= bytes_written;
+    }
+}
+
+// copies a string column into a csv line and returns where the line goes on. one with a comma, quote or line break in it is
+// put in quotes, with its quotes doubled, so parse_csv_field() reads it back as it was
+char* export_csv_field(char* line, u_int8_t* bytes, u_int8_t length) {
+    bool quoted = false;
+    for (u_int32_t i = 0; i < length && !quoted; i++) {
+        quoted = bytes[i] == ',' || bytes[i] == '"' || bytes[i] == '\n' || bytes[i] == '\r';
+    }
+    if (!quoted) {
+        memcpy(line, bytes, length);
+        return line + length;
+    }
+    *line++ = '"';
+    for (u_int32_t i = 0; i < length; i++) {
+        if (bytes[i] == '"') {
+            *line++ = '"';
+        }
+        *line++ = bytes[i];
+    }
+    *line++ = '"';
+    return line;
+}
+
+// formats one encoded row as a csv line, returns its length
+u_int32_t export_csv_row(void* record, char* destination) {
+    u_int8_t* bytes = record;
+    u_int32_t id;
+    memcpy(&id, bytes, ID_SIZE);
+    bytes += ID_SIZE;
+
+    // the id's digits come out backwards, so they're built at the end of a scratch buffer
+    char digits[10];
+    u_int32_t num_digits = 0;
+    do {
+        digits[sizeof(digits) - ++num_digits] = '0' + id % 10;
+        id /= 10;
+    } while (id > 0);
+    char* line = destination;
+    memcpy(line, digits + sizeof(digits) - num_digits, num_digits);
+    line += num_digits;
+
+    u_int8_t username_length = *bytes++;
+    *line++ = ',';
+    line = export_csv_field(line, bytes, username_length);
+    bytes += username_length;
+
+    u_int8_t email_length = *bytes++;
+    *line++ = ',';
+    line = export_csv_field(line, bytes, email_length);
+    *line++ = '\n';
+    return line - destination;
+}
+
+// the fixed width version of an encoded row
+u_int32_t export_binary_row(void* record, u_int8_t* destination) {
+    u_int8_t* bytes = record;
+    memset(destination, 0, ROW_SIZE);
+    memcpy(destination + ID_OFFSET, bytes, ID_SIZE);
+    bytes += ID_SIZE;
+    u_int8_t username_length = *bytes++;
+    memcpy(destination + USERNAME_OFFSET, bytes, username_length);
+    bytes += username_length;
+    u_int8_t email_length = *bytes++;
+    memcpy(destination + EMAIL_OFFSET, bytes, email_length);
+    return ROW_SIZE;
+}
+
+// writes every row to filename in id order. returns false if the file can't be created
+bool table_export(Table* table, const char* filename, ExportFormat format, u_int32_t* num_rows) {
+    int file_descriptor = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (file_descriptor == -1) {
+        return false;
+    }
+
+    u_int8_t* buffer = malloc(EXPORT_BUFFER_SIZE);
+    size_t length = 0;
+    if (format == EXPORT_BINARY) {
+        memcpy(buffer, EXPORT_BINARY_MAGIC, EXPORT_BINARY_MAGIC_SIZE);
+        memcpy(buffer + EXPORT_BINARY_MAGIC_SIZE, &EXPORT_BINARY_VERSION, sizeof(u_int32_t));
+        memcpy(buffer + EXPORT_BINARY_MAGIC_SIZE + sizeof(u_int32_t), &ROW_SIZE, sizeof(u_int32_t));
+        length = EXPORT_BINARY_HEADER_SIZE;
+    }
+
+    // table_start() finds the leftmost leaf, from there it's just the leaf chain
+    Pager* pager = table->pager;
+    Cursor* cursor = table_start(table);
+    u_int32_t page_num = cursor->end_of_table ? 0 : cursor->page_num;
+    close_cursor(cursor);
+
+    *num_rows = 0;
+    Readahead readahead;
+    memset(&readahead, 0, sizeof(Readahead));
+    while (page_num != 0) {
+        void* node = get_page(pager, page_num);
+        scan_readahead(pager, &readahead, node);
+        u_int32_t num_cells = *leaf_node_num_cells(node);
+        for (u_int32_t i = 0; i < num_cells; i++) {
+            if (length + EXPORT_MAX_LINE_SIZE > EXPORT_BUFFER_SIZE) {
+                export_write(file_descriptor, buffer, length);
+                length = 0;
+            }
+            void* record = leaf_node_value(node, i);
+            if (format == EXPORT_CSV) {
+                length += export_csv_row(record, (char*)buffer + length);
+            } else {
+                length += export_binary_row(record, buffer + length);
+            }
+        }
+        *num_rows += num_cells;
+        u_int32_t next_page_num = *leaf_node_next_leaf(node);
+        unpin_page(pager, page_num);
+        page_num = next_page_num;
+    }
+    export_write(file_descriptor, buffer, length);
+    free(buffer);
+
+    if (close(file_descriptor) == -1) {
+        printf("Error closing export file: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+// checkpoints whatever is still dirty, closes database file, and frees memory allocated for Pager and Table data structures
+void db_close(Table* table) {
+    Pager* pager = table->pager;
+
+    pager_checkpoint(pager);
+    if (pager->wal != NULL) {
+        wal_close(pager->wal);
+    }
+    if (pager->use_mmap) {
+        // the mapping grows the file ahead of time, so cut off the unused tail again
+        munmap(pager->map, MMAP_RESERVE_BYTES);
+        if (ftruncate(pager->file_descriptor, page_offset(pager->num_pages)) == -1) {
+            printf("Error truncating db file: %d\n", errno);
+            exit(EXIT_FAILURE);
+        }
+        free(pager->page_flags);
+    }
+
+    if (pager->ring != NULL) {
+        io_ring_close(pager->ring);
+    }
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(pager->pool);
+    free(pager->frames);
+    free(pager->page_table);
+    for (u_int32_t i = 0; i < pager->num_latch_chunks; i++) {
+        if (pager->latch_chunks[i] != NULL) {
+            for (u_int32_t j = 0; j < LATCH_CHUNK_PAGES; j++) {
+                pthread_rwlock_destroy(&pager->latch_chunks[i][j].lock);
+            }
+            free(pager->latch_chunks[i]);
+        }
+    }
+    free(pager->latch_chunks);
+    free(pager->write_latches);
+    pthread_mutex_destroy(&pager->latch);
+    pthread_mutex_destroy(&table->writer);
+    free(pager);
+    free(table);
+}
+
+// method for initializing an InputBuffer object
+InputBuffer* new_input_buffer() {
+    InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
+    input_buffer->buffer = NULL;
+    input_buffer->buffer_length = 0;
+    input_buffer->input_length = 0;
+
+    return input_buffer;
+}
+
+void close_input_buffer(InputBuffer* input_buffer) {
+    free(input_buffer->buffer);
+    free(input_buffer);
+}
+
+// helper function for print_tree(). taking the tree level as input, it indents before printing the node based on how deep it is in the tree
+void indent(u_int32_t level) {
+    for (u_int32_t i = 0; i < level; i++) {
+        printf("  ");
+    }
+}
+
+// recursively prints nodes.. prints each node and its children
+void print_tree(Pager* pager, u_int32_t page_num, u_int32_t indentation_level) {
+    // the node stays pinned while we recurse, so the pool has to be at least as deep as the tree
+    void* node = get_page(pager, page_num);
+    u_int32_t num_keys, child;
+    switch (get_node_type(node)) {
+        case (NODE_LEAF):
+            num_keys = *leaf_node_num_cells(node);
+            indent(indentation_level);
+            printf("- leaf (size %d)\n", num_keys);
+            for (u_int32_t i = 0; i < num_keys; i++) {
+                indent(indentation_level + 1);
+                printf("- %d\n", *leaf_node_key(node, i));
+            }
+            break;
+        case (NODE_INTERNAL):
+            num_keys = *internal_node_num_keys(node);
+            indent(indentation_level);
+            printf("- internal (size %d)\n", num_keys);
+            for (u_int32_t i = 0; i < num_keys; i++) {
+                child = *internal_node_child(node, i);
+                print_tree(pager, child, indentation_level + 1);
+
+                indent(indentation_level + 1);
+                printf("- key %d\n", *internal_node_key(node, i));
+            }
+            child = *internal_node_right_child(node);
+            print_tree(pager, child, indentation_level + 1);
+            break;
+    }
+    unpin_page(pager, page_num);
+}
+
+// depth of the tree, counting the root as level 1. every leaf sits at the same depth, so following the left edge is enough
+u_int32_t tree_depth(Pager* pager, u_int32_t page_num) {
+    u_int32_t root_page_num = page_num;
+    u_int32_t depth = 0;
+    latch_page(pager, page_num);
+    while (true) {
+        void* node = get_page(pager, page_num);
+        NodeType type = get_node_type(node);
+        u_int32_t child = type == NODE_INTERNAL ? *internal_node_child(node, 0) : 0;
+        unpin_page(pager, page_num);
+        depth++;
+        if (type == NODE_LEAF) {
+            unlatch_page(pager, page_num);
+            return depth;
+        }
+        if (latch_child(pager, page_num, child)) {
+            page_num = child;
+        } else {
+            page_num = root_page_num;
+            depth = 0;
+            latch_page(pager, page_num);
+        }
+    }
+}
+
+// print out all constants
+void print_constants() {
+    printf("PAGE_SIZE: %d\n", PAGE_SIZE);
+    printf("ROW_SIZE: %d\n", ROW_SIZE);
+    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+    printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
+}
+
+// parse meta commands
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+    if (strcmp(input_buffer->buffer, ".exit") == 0) {
+        return META_COMMAND_EXIT;
+    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
+        printf("Tree:\n");
+        print_tree(table->pager, table->root_page_num, 0);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+        u_int32_t num_written = pager_checkpoint(table->pager);
+        printf("Checkpoint wrote %d dirty pages.\n", num_written);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+        printf("Tree depth: %d\n", tree_depth(table->pager, table->root_page_num));
+        printf("Pages: %u\n", table->pager->num_pages);
+        printf("Dirty pages: %d\n", table->pager->num_dirty);
+        void* header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+        printf("Free pages: %u\n", *db_header_free_pages(header));
+        unpin_page(table->pager, DB_HEADER_PAGE_NUM);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".load ", 6) == 0) {
+        u_int32_t line_num;
+        switch (table_bulk_load(table, input_buffer->buffer + 6, &line_num)) {
+            case (LOAD_SUCCESS):
+                printf("Loaded %d rows.\n", line_num);
+                break;
+            case (LOAD_TABLE_NOT_EMPTY):
+                printf("Error: Table must be empty to bulk load.\n");
+                break;
+            case (LOAD_CANT_OPEN_FILE):
+                printf("Unable to open file '%s'.\n", input_buffer->buffer + 6);
+                break;
+            case (LOAD_INVALID_ROW):
+                printf("Error: Invalid row on line %d.\n", line_num);
+                break;
+            case (LOAD_DUPLICATE_KEY):
+                printf("Error: Duplicate key.\n");
+                break;
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".export ", 8) == 0) {
+        // .export <file> [csv|binary], csv being the default
+        strtok(input_buffer->buffer, " ");
+        char* filename = strtok(NULL, " ");
+        char* format_name = strtok(NULL, " ");
+        ExportFormat format = format_name != NULL && strcmp(format_name, "binary") == 0 ? EXPORT_BINARY : EXPORT_CSV;
+        bool known_format = format_name == NULL || strcmp(format_name, "csv") == 0 || strcmp(format_name, "binary") == 0;
+        if (filename == NULL || !known_format || strtok(NULL, " ") != NULL) {
+            printf("Usage: .export <file> [csv|binary]\n");
+            return META_COMMAND_SUCCESS;
+        }
+
+        u_int32_t num_rows;
+        if (table_export(table, filename, format, &num_rows)) {
+            printf("Exported %d rows.\n", num_rows);
+        } else {
+            printf("Unable to open file '%s'.\n", filename);
+        }
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
+        printf("Constants:\n");
+        print_constants();
+        return META_COMMAND_SUCCESS;
+    } else {
+        return META_COMMAND_UNRECOGNIZED_COMMAND;
+    }
+}
+
+// parses a whole token as an id. returns PREPARE_SUCCESS, PREPARE_NEGATIVE_ID or PREPARE_SYNTAX_ERROR
+PrepareResult parse_id(const char* token, u_int32_t* id) {
+    if (token == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    if (token[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(token, &end, 10);
+    if (end == token || *end != '\0' || errno != 0 || value > UINT32_MAX) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *id = value;
+    return PREPARE_SUCCESS;
+}
+
+// the row a parameter's column belongs to. inserts have their own, an update keeps its values in row_to_insert
+Row* statement_row(Statement* statement, u_int32_t row) {
+    return statement->type == STATEMENT_INSERT ? &statement->rows[row] : &statement->row_to_insert;
+}
+
+// a ? where a value should be. the value comes later from statement_bind()
+bool is_param(const char* token) {
+    return token != NULL && strcmp(token, "?") == 0;
+}
+
+void statement_add_param(Statement* statement, ParamTarget target, u_int32_t row) {
+    if (statement->num_params == statement->params_capacity) {
+        statement->params_capacity = statement->params_capacity == 0 ? 4 : statement->params_capacity * 2;
+        statement->params = realloc(statement->params, statement->params_capacity * sizeof(Param));
+    }
+    statement->params[statement->num_params].target = target;
+    statement->params[statement->num_params].row = row;
+    statement->num_params++;
+}
+
+// like parse_id(), but a ? is fine too and turns into a parameter
+PrepareResult parse_id_or_param(Statement* statement, char* token, u_int32_t* id, ParamTarget target, u_int32_t row) {
+    if (is_param(token)) {
+        statement_add_param(statement, target, row);
+        *id = 0;
+        return PREPARE_SUCCESS;
+    }
+    return parse_id(token, id);
+}
+
+// copies a string value into a column, or makes it a parameter if it's a ?
+PrepareResult parse_text_or_param(Statement* statement, char* token, char* column, u_int32_t max_length, ParamTarget target,
+                                  u_int32_t row) {
+    if (is_param(token)) {
+        statement_add_param(statement, target, row);
+        column[0] = '\0';
+        return PREPARE_SUCCESS;
+    }
+    if (strlen(token) > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    strcpy(column, token);
+    return PREPARE_SUCCESS;
+}
+
+// adds a row to an insert from its three column values, any of which can be a ?
+PrepareResult prepare_row(Statement* statement, char* id, char* username, char* email) {
+    if (statement->num_rows == statement->rows_capacity) {
+        statement->rows_capacity = statement->rows_capacity == 0 ? 1 : statement->rows_capacity * 2;
+        statement->rows = realloc(statement->rows, statement->rows_capacity * sizeof(Row));
+    }
+    u_int32_t row_index = statement->num_rows++;
+    Row* row = &statement->rows[row_index];
+    memset(row, 0, sizeof(Row));
+
+    PrepareResult result = parse_id_or_param(statement, id, &row->id, PARAM_ROW_ID, row_index);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    result = parse_text_or_param(statement, username, row->username, COLUMN_USERNAME_SIZE, PARAM_ROW_USERNAME, row_index);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    return parse_text_or_param(statement, email, row->email, COLUMN_EMAIL_SIZE, PARAM_ROW_EMAIL, row_index);
+}
+
+// strips the spaces off both ends of a string in place
+char* trim(char* string) {
+    string += strspn(string, " ");
+    char* end = string + strlen(string);
+    while (end > string && end[-1] == ' ') {
+        end--;
+    }
+    *end = '\0';
+    return string;
+}
+
+// (id, username, email), (id, username, email), ...
+PrepareResult prepare_values(Statement* statement, char* values) {
+    char* position = values;
+    while (true) {
+        position += strspn(position, " ");
+        char* close = strchr(position, ')');
+        if (*position != '(' || close == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        *close = '\0';
+
+        // exactly three non-empty values between the parentheses
+        char* fields[3];
+        char* field = position + 1;
+        for (u_int32_t i = 0; i < 3; i++) {
+            char* comma = strchr(field, ',');
+            if ((i < 2) != (comma != NULL)) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (comma != NULL) {
+                *comma = '\0';
+            }
+            fields[i] = trim(field);
+            if (fields[i][0] == '\0') {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            field = comma + 1;
+        }
+
+        PrepareResult result = prepare_row(statement, fields[0], fields[1], fields[2]);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+
+        position = close + 1;
+        position += strspn(position, " ");
+        if (*position == '\0') {
+            return PREPARE_SUCCESS;
+        }
+        if (*position != ',') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        position++;
+    }
+}
+
+// insert <id> <username> <email>, or insert values (id, username, email), ... for several rows at once
+PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    char* buffer_end = input_buffer->buffer + strlen(input_buffer->buffer);
+
+    // strtok points at the beginning of the string on the first call, tokenizes the string
+    // subsequent calls of strtok require NULL pointers and tokenize the next tokens starting with the first non-delimiter and ending with delimiter
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "insert") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    char* id_string = strtok(NULL, " ");
+
+    if (id_string != NULL && strcmp(id_string, "values") == 0) {
+        // the rows are everything after the keyword, which strtok hasn't looked at yet
+        char* values = id_string + strlen(id_string);
+        if (values < buffer_end) {
+            values++;
+        }
+        return prepare_values(statement, values);
+    }
+
+    char* username = strtok(NULL, " ");
+    char* email = strtok(NULL, " ");
+
+    if (id_string == NULL || username == NULL || email == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    return prepare_row(statement, id_string, username, email);
+}
+
+bool parse_index_column(const char* token, IndexColumn* column) {
+    if (token != NULL && strcmp(token, "username") == 0) {
+        *column = INDEX_USERNAME;
+    } else if (token != NULL && strcmp(token, "email") == 0) {
+        *column = INDEX_EMAIL;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * [where id = N | where id between A and B | where username|email = V | where username|email like V]
+ * A condition on id turns into a key range so a statement can seek straight to its start instead of scanning the table. One on
+ * username or email is kept as text (see execute_text_select()); like only understands a trailing %, for a prefix.
+ * token is the first token after the statement's keyword, and is left on the first one after the clause.
+ */
+PrepareResult prepare_where(Statement* statement, char** token) {
+    statement->min_id = 0;
+    statement->max_id = UINT32_MAX;
+    statement->text_where = false;
+
+    PrepareResult result;
+    if (*token != NULL && strcmp(*token, "where") == 0) {
+        char* column = strtok(NULL, " ");
+        char* operator = strtok(NULL, " ");
+        if (column == NULL || operator == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        if (parse_index_column(column, &statement->column)) {
+            char* value = strtok(NULL, " ");
+            if (value == NULL || (strcmp(operator, "=") != 0 && strcmp(operator, "like") != 0)) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            statement->text_where = true;
+            statement->like = strcmp(operator, "like") == 0;
+            *token = strtok(NULL, " ");
+            return parse_text_or_param(statement, value, statement->where_value, COLUMN_EMAIL_SIZE + 1, PARAM_WHERE_VALUE, 0);
+        }
+        if (strcmp(column, "id") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        if (strcmp(operator, "=") == 0) {
+            if ((result = parse_id_or_param(statement, strtok(NULL, " "), &statement->min_id, PARAM_KEY, 0)) != PREPARE_SUCCESS) {
+                return result;
+            }
+            statement->max_id = statement->min_id;
+        } else if (strcmp(operator, "between") == 0) {
+            if ((result = parse_id_or_param(statement, strtok(NULL, " "), &statement->min_id, PARAM_MIN_ID, 0)) != PREPARE_SUCCESS) {
+                return result;
+            }
+            char* and = strtok(NULL, " ");
+            if (and == NULL || strcmp(and, "and") != 0) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if ((result = parse_id_or_param(statement, strtok(NULL, " "), &statement->max_id, PARAM_MAX_ID, 0)) != PREPARE_SUCCESS) {
+                return result;
+            }
+        } else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        *token = strtok(NULL, " ");
+    }
+    return PREPARE_SUCCESS;
+}
+
+bool parse_aggregate(char* token, AggregateType* aggregate) {
+    if (strcmp(token, "count(*)") == 0) {
+        *aggregate = AGGREGATE_COUNT;
+    } else if (strcmp(token, "min(id)") == 0) {
+        *aggregate = AGGREGATE_MIN;
+    } else if (strcmp(token, "max(id)") == 0) {
+        *aggregate = AGGREGATE_MAX;
+    } else if (strcmp(token, "sum(id)") == 0) {
+        *aggregate = AGGREGATE_SUM;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// select [count(*), min(id), max(id), sum(id)] [where ...] [limit N] [offset M]. limit and offset don't go with aggregates
+PrepareResult prepare_select(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->limit = NO_LIMIT;
+    statement->offset = 0;
+    statement->num_aggregates = 0;
+
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "select") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    char* token = strtok(NULL, " ,");
+    AggregateType aggregate;
+    while (token != NULL && parse_aggregate(token, &aggregate)) {
+        if (statement->num_aggregates == MAX_AGGREGATES) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->aggregates[statement->num_aggregates++] = aggregate;
+        token = strtok(NULL, " ,");
+    }
+
+    PrepareResult result = prepare_where(statement, &token);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    // aggregates only work on ids
+    if (statement->text_where && statement->num_aggregates > 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    if (token != NULL && strcmp(token, "limit") == 0 && statement->num_aggregates == 0) {
+        if ((result = parse_id_or_param(statement, strtok(NULL, " "), &statement->limit, PARAM_LIMIT, 0)) != PREPARE_SUCCESS) {
+            return result;
+        }
+        token = strtok(NULL, " ");
+    }
+    if (token != NULL && strcmp(token, "offset") == 0 && statement->num_aggregates == 0) {
+        if ((result = parse_id_or_param(statement, strtok(NULL, " "), &statement->offset, PARAM_OFFSET, 0)) != PREPARE_SUCCESS) {
+            return result;
+        }
+        token = strtok(NULL, " ");
+    }
+
+    // anything left over isn't something we understand
+    if (token != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// delete [where ...]. without a where clause every row goes
+PrepareResult prepare_delete(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_DELETE;
+
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "delete") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    char* token = strtok(NULL, " ");
+    PrepareResult result = prepare_where(statement, &token);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    if (token != NULL || statement->text_where) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// create index on username|email
+PrepareResult prepare_create_index(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_CREATE_INDEX;
+
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "create") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+    char* index = strtok(NULL, " ");
+    char* on = strtok(NULL, " ");
+    char* column = strtok(NULL, " ");
+    if (index == NULL || strcmp(index, "index") != 0 || on == NULL || strcmp(on, "on") != 0 ||
+        !parse_index_column(column, &statement->column) || strtok(NULL, " ") != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// update <id> set username=<username>, email=<email>. either column can be left out
+PrepareResult prepare_update(InputBuffer* input_buffer, Statement* statement) {
+    statement->type = STATEMENT_UPDATE;
+    statement->set_username = false;
+    statement->set_email = false;
+
+    char* keyword = strtok(input_buffer->buffer, " ");
+    if (strcmp(keyword, "update") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    PrepareResult result = parse_id_or_param(statement, strtok(NULL, " "), &statement->row_to_insert.id, PARAM_ROW_ID, 0);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    char* set = strtok(NULL, " ");
+    if (set == NULL || strcmp(set, "set") != 0) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* assignment;
+    while ((assignment = strtok(NULL, " ,")) != NULL) {
+        char* value = strchr(assignment, '=');
+        if (value == NULL || value[1] == '\0') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        *value++ = '\0';
+
+        if (strcmp(assignment, "username") == 0) {
+            result = parse_text_or_param(statement, value, statement->row_to_insert.username, COLUMN_USERNAME_SIZE,
+                                         PARAM_ROW_USERNAME, 0);
+            statement->set_username = true;
+        } else if (strcmp(assignment, "email") == 0) {
+            result = parse_text_or_param(statement, value, statement->row_to_insert.email, COLUMN_EMAIL_SIZE,
+                                         PARAM_ROW_EMAIL, 0);
+            statement->set_email = true;
+        } else {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+
+    if (!statement->set_username && !statement->set_email) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// parse sql commands
+PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
+    statement->rows = NULL;
+    statement->num_rows = 0;
+    statement->rows_capacity = 0;
+    statement->params = NULL;
+    statement->num_params = 0;
+    statement->params_capacity = 0;
+
+    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
+        return prepare_insert(input_buffer, statement);
+    }
+
+    if (strncmp(input_buffer->buffer, "select", 6) == 0) {
+        return prepare_select(input_buffer, statement);
+    }
+
+    if (strncmp(input_buffer->buffer, "delete", 6) == 0) {
+        return prepare_delete(input_buffer, statement);
+    }
+
+    if (strncmp(input_buffer->buffer, "update", 6) == 0) {
+        return prepare_update(input_buffer, statement);
+    }
+
+    if (strncmp(input_buffer->buffer, "create", 6) == 0) {
+        return prepare_create_index(input_buffer, statement);
+    }
+
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+void free_statement(Statement* statement) {
+    free(statement->rows);
+    free(statement->params);
+}
+
+/**
+ * Prepared statements. A statement parsed once with ?s in place of values can be run any number of times, binding new values
+ * each time, without going through the parser again:
+ *
+ *     Statement statement;
+ *     prepare_sql("insert ? ? ?", &statement);
+ *     statement_bind(&statement, 0, "1");
+ *     statement_bind(&statement, 1, "user1");
+ *     statement_bind(&statement, 2, "person1@example.com");
+ *     execute_statement(&statement, table);
+ *     ...
+ *     free_statement(&statement);
+ *
+ * The ?s are numbered from 0, left to right. A value is checked when it's bound, the same way it would be when parsed.
+ */
+// the parser tokenizes with strtok(), which keeps its place in a global, so in concurrent mode statements get parsed one at a time
+pthread_mutex_t parse_latch = PTHREAD_MUTEX_INITIALIZER;
+
+PrepareResult prepare_sql(const char* sql, Statement* statement) {
+    InputBuffer input_buffer;
+    input_buffer.buffer = strdup(sql);
+    input_buffer.buffer_length = strlen(sql) + 1;
+    input_buffer.input_length = strlen(sql);
+
+    pthread_mutex_lock(&parse_latch);
+    PrepareResult result = prepare_statement(&input_buffer, statement);
+    pthread_mutex_unlock(&parse_latch);
+    free(input_buffer.buffer);
+    return result;
+}
+
+PrepareResult statement_bind(Statement* statement, u_int32_t index, const char* value) {
+    if (index >= statement->num_params) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Param* param = &statement->params[index];
+    Row* row = statement_row(statement, param->row);
+
+    if (param->target == PARAM_ROW_USERNAME || param->target == PARAM_ROW_EMAIL) {
+        bool username = param->target == PARAM_ROW_USERNAME;
+        if (strlen(value) > (username ? COLUMN_USERNAME_SIZE : COLUMN_EMAIL_SIZE)) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        strcpy(username ? row->username : row->email, value);
+        return PREPARE_SUCCESS;
+    }
+    if (param->target == PARAM_WHERE_VALUE) {
+        if (strlen(value) > COLUMN_EMAIL_SIZE + 1) {
+            return PREPARE_STRING_TOO_LONG;
+        }
+        strcpy(statement->where_value, value);
+        return PREPARE_SUCCESS;
+    }
+
+    u_int32_t id;
+    PrepareResult result = parse_id(value, &id);
+    if (result != PREPARE_SUCCESS) {
+        return result;
+    }
+    switch (param->target) {
+        case (PARAM_ROW_ID):
+            row->id = id;
+            break;
+        case (PARAM_KEY):
+            statement->min_id = id;
+            statement->max_id = id;
+            break;
+        case (PARAM_MIN_ID):
+            statement->min_id = id;
+            break;
+        case (PARAM_MAX_ID):
+            statement->max_id = id;
+            break;
+        case (PARAM_LIMIT):
+            statement->limit = id;
+            break;
+        case (PARAM_OFFSET):
+            statement->offset = id;
+            break;
+        default:
+            break;
+    }
+    return PREPARE_SUCCESS;
+}
+
+// compare_row_ids() for an array of pointers to rows
+int compare_row_pointer_ids(const void* a, const void* b) {
+    return compare_row_ids(*(Row* const*)a, *(Row* const*)b);
+}
+
+/**
+ * execute the insert command!! takes the rows (id, username, email) from the statement and inserts them into the table.
+ * The rows go in sorted by id, so the ones headed for the same leaf are next to each other: they share a single descent from
+ * the root and go into the leaf together in one pass over its slot directory (see leaf_node_insert_records()), as many as it
+ * has room for. A row that doesn't fit goes in on its own and splits the leaf like always.
+ * Rows whose id is already taken are skipped, and the statement reports a duplicate key once the others are in.
+ */
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+    Pager* pager = table->pager;
+    u_int32_t num_rows = statement->num_rows;
+    Row** rows = malloc(num_rows * sizeof(Row*));
+    for (u_int32_t i = 0; i < num_rows; i++) {
+        rows[i] = &statement->rows[i];
+    }
+    qsort(rows, num_rows, sizeof(Row*), compare_row_pointer_ids);
+
+    u_int32_t* keys = malloc(num_rows * sizeof(u_int32_t));
+    void** records = malloc(num_rows * sizeof(void*));
+    u_int32_t* sizes = malloc(num_rows * sizeof(u_int32_t));
+    u_int8_t* encoded = malloc(num_rows * ROW_SIZE);
+    for (u_int32_t i = 0; i < num_rows; i++) {
+        keys[i] = rows[i]->id;
+        records[i] = encoded + i * ROW_SIZE;
+        sizes[i] = serialize_row(rows[i], records[i]);
+    }
+
+    u_int32_t duplicates = 0;
+    u_int32_t i = 0;
+    while (i < num_rows) {
+        Cursor* cursor = table_find_insert(table, keys[i]);
+        // the cursor keeps the leaf pinned for us
+        void* node = get_page(pager, cursor->page_num);
+        u_int32_t num_cells = *leaf_node_num_cells(node);
+
+        // the rows after this one that surely belong in the same leaf: ones up to its biggest key, or all of them if it's the
+        // last leaf. no more than fit in its free space though
+        bool last_leaf = *leaf_node_next_leaf(node) == 0;
+        u_int32_t max_key = num_cells > 0 ? *leaf_node_key(node, num_cells - 1) : 0;
+        u_int32_t room = leaf_node_gap(node) + *leaf_node_fragmented(node);
+        u_int32_t needed = LEAF_NODE_SLOT_SIZE + sizes[i];
+        u_int32_t end = i + 1;
+        while (end < num_rows && (last_leaf || keys[end] <= max_key) && needed + LEAF_NODE_SLOT_SIZE + sizes[end] <= room) {
+            needed += LEAF_NODE_SLOT_SIZE + sizes[end];
+            end++;
+        }
+
+        u_int32_t skipped = duplicates;
+        if (end - i > 1 && leaf_node_insert_records(node, end - i, keys + i, records + i, sizes + i, &duplicates)) {
+            mark_page_dirty(pager, cursor->page_num);
+            unpin_page(pager, cursor->page_num);
+            add_row_counts(pager, cursor->page_num, (end - i) - (duplicates - skipped));
+            close_cursor(cursor);
+            // leaf_node_insert_records() zeroes the size of every row it skipped
+            for (; i < end; i++) {
+                if (sizes[i] > 0) {
+                    index_add_row(table, rows[i]);
+                }
+            }
+            continue;
+        }
+
+        bool duplicate = cursor->cell_num < num_cells && *leaf_node_key(node, cursor->cell_num) == keys[i];
+        unpin_page(pager, cursor->page_num);
+        if (duplicate) {
+            duplicates++;
+        } else {
+            leaf_node_insert(cursor, keys[i], rows[i]);
+        }
+        close_cursor(cursor);
+        if (!duplicate) {
+            index_add_row(table, rows[i]);
+        }
+        i++;
+    }
+
+    free(rows);
+    free(keys);
+    free(records);
+    free(sizes);
+    free(encoded);
+
+    return duplicates > 0 ? EXECUTE_DUPLICATE_KEY : EXECUTE_SUCCESS;
+}
+
+/**
+ * Aggregates. count(*), min(id), max(id) and sum(id) only need keys, so they're worked out straight from the key arrays of
+ * the leaves without decoding a single row. The query's key range is cut into pieces at separator keys from the top of the
+ * tree, and worker threads take pieces off a shared counter until none are left. Each piece is a seek to its first key and
+ * a walk along the leaf chain to its last. The threads' partial results are combined at the end.
+ * Workers only read, and the pager's latch covers the pins they take, so nothing else needs locking while they run.
+ */
+typedef struct {
+    u_int64_t count;
+    u_int64_t sum;
+    u_int32_t min;
+    u_int32_t max;
+} AggregateResult;
+
+typedef struct {
+    Table* table;
+    u_int32_t* piece_starts;
+    u_int32_t* piece_ends;
+    u_int32_t num_pieces;
+    u_int32_t next_piece;       // the first piece nobody has taken yet
+} AggregateScan;
+
+typedef struct {
+    AggregateScan* scan;
+    AggregateResult result;
+    pthread_t thread;
+} AggregateWorker;
+
+// folds the keys min_id <= key <= max_id into result
+void aggregate_range(Table* table, u_int32_t min_id, u_int32_t max_id, AggregateResult* result) {
+    Pager* pager = table->pager;
+    Cursor* cursor = table_seek(table, min_id);
+
+    while (!cursor->end_of_table) {
+        u_int32_t cell_num = cursor->cell_num;
+        void* node = get_page(pager, cursor->page_num);
+        u_int32_t num_cells = *leaf_node_num_cells(node);
+        u_int32_t* keys = leaf_node_keys(node);
+        // the range can end in this leaf
+        u_int32_t end = num_cells;
+        if (num_cells > 0 && keys[num_cells - 1] > max_id) {
+            end = leaf_node_lower_bound(node, max_id + 1);
+        }
+
+        if (cell_num < end) {
+            if (result->count == 0) {
+                result->min = keys[cell_num];
+            }
+            result->max = keys[end - 1];
+            result->count += end - cell_num;
+            u_int64_t sum = 0;
+            for (u_int32_t i = cell_num; i < end; i++) {
+                sum += keys[i];
+            }
+            result->sum += sum;
+        }
+
+        unpin_page(pager, cursor->page_num);
+        if (end < num_cells) {
+            break;
+        }
+        cursor_next_leaf(cursor);
+    }
+    close_cursor(cursor);
+}
+
+void aggregate_result_merge(AggregateResult* into, AggregateResult* from) {
+    if (from->count == 0) {
+        return;
+    }
+    if (into->count == 0 || from->min < into->min) {
+        into->min = from->min;
+    }
+    if (into->count == 0 || from->max > into->max) {
+        into->max = from->max;
+    }
+    into->count += from->count;
+    into->sum += from->sum;
+}
+
+void* aggregate_worker_run(void* argument) {
+    AggregateWorker* worker = argument;
+    AggregateScan* scan = worker->scan;
+    while (true) {
+        u_int32_t piece = __atomic_fetch_add(&scan->next_piece, 1, __ATOMIC_RELAXED);
+        if (piece >= scan->num_pieces) {
+            return NULL;
+        }
+        AggregateResult result = { 0 };
+        aggregate_range(scan->table, scan->piece_starts[piece], scan->piece_ends[piece], &result);
+        aggregate_result_merge(&worker->result, &result);
+    }
+}
+
+// separator keys from the top levels of the subtree at page_num, in order. page_num comes latched and gets let go here. a reader
+// holds the latches of the path it's on, so it only tries for the children's. false means one was busy: everything was let go,
+// and busy_page_num says which page to wait for before trying again
+bool collect_split_keys(Pager* pager, u_int32_t page_num, u_int32_t levels, u_int32_t** keys, u_int32_t* num_keys,
+                        u_int32_t* capacity, u_int32_t* busy_page_num) {
+    void* node = get_page(pager, page_num);
+    bool complete = true;
+    if (get_node_type(node) == NODE_INTERNAL) {
+        u_int32_t node_num_keys = *internal_node_num_keys(node);
+        for (u_int32_t i = 0; complete && i <= node_num_keys; i++) {
+            if (levels > 1) {
+                u_int32_t child = i < node_num_keys ? *internal_node_child(node, i) : *internal_node_right_child(node);
+                if (!try_latch_page(pager, child)) {
+                    *busy_page_num = child;
+                    complete = false;
+                    break;
+                }
+                complete = collect_split_keys(pager, child, levels - 1, keys, num_keys, capacity, busy_page_num);
+            }
+            if (i < node_num_keys) {
+                if (*num_keys == *capacity) {
+                    *capacity = *capacity == 0 ? 64 : *capacity * 2;
+                    *keys = realloc(*keys, *capacity * sizeof(u_int32_t));
+                }
+                (*keys)[(*num_keys)++] = *internal_node_key(node, i);
+            }
+        }
+    }
+    unpin_page(pager, page_num);
+    unlatch_page(pager, page_num);
+    return complete;
+}
+
+void print_aggregates(Statement* statement, AggregateResult* result) {
+    FILE* out = results();
+    fprintf(out, "(");
+    for (u_int32_t i = 0; i < statement->num_aggregates; i++) {
+        if (i > 0) {
+            fprintf(out, ", ");
+        }
+        switch (statement->aggregates[i]) {
+            case (AGGREGATE_COUNT):
+                fprintf(out, "%llu", (unsigned long long)result->count);
+                break;
+            case (AGGREGATE_SUM):
+                fprintf(out, "%llu", (unsigned long long)result->sum);
+                break;
+            case (AGGREGATE_MIN):
+            case (AGGREGATE_MAX):
+                // there's no smallest or biggest id of nothing
+                if (result->count == 0) {
+                    fprintf(out, "NULL");
+                } else {
+                    fprintf(out, "%u", statement->aggregates[i] == AGGREGATE_MIN ? result->min : result->max);
+                }
+                break;
+        }
+    }
+    fprintf(out, ")\n");
+}
+
+ExecuteResult execute_aggregate(Statement* statement, Table* table) {
+    Pager* pager = table->pager;
+
+    // only sum needs the keys themselves. the rest comes from the row counts: the ranks of the two ends of the range give the
+    // count, and the first and last rows in it are the min and max, all in a few descents from the root
+    bool needs_scan = false;
+    for (u_int32_t i = 0; i < statement->num_aggregates; i++) {
+        needs_scan = needs_scan || statement->aggregates[i] == AGGREGATE_SUM;
+    }
+    if (!needs_scan) {
+        AggregateResult result = { 0 };
+        u_int32_t first = table_rank(table, statement->min_id);
+        u_int32_t end = statement->max_id == UINT32_MAX ? table_num_rows(table) : table_rank(table, statement->max_id + 1);
+        if (end > first) {
+            result.count = end - first;
+            result.min = table_nth_key(table, first);
+            result.max = table_nth_key(table, end - 1);
+        }
+        print_aggregates(statement, &result);
+        return EXECUTE_SUCCESS;
+    }
+
+    u_int32_t num_threads = table->num_threads;
+    if (!pager->use_mmap && num_threads > pager->num_frames / SCAN_PINS_PER_THREAD) {
+        num_threads = pager->num_frames / SCAN_PINS_PER_THREAD;
+    }
+
+    // go one level further down the tree at a time until there are enough separators to keep every thread busy
+    u_int32_t* split_keys = NULL;
+    u_int32_t num_split_keys = 0;
+    u_int32_t capacity = 0;
+    u_int32_t depth = tree_depth(pager, table->root_page_num);
+    for (u_int32_t levels = 1; num_threads > 1 && levels < depth; levels++) {
+        u_int32_t busy_page_num;
+        num_split_keys = 0;
+        latch_page(pager, table->root_page_num);
+        while (!collect_split_keys(pager, table->root_page_num, levels, &split_keys, &num_split_keys, &capacity, &busy_page_num)) {
+            wait_for_page(pager, busy_page_num);
+            num_split_keys = 0;
+            latch_page(pager, table->root_page_num);
+        }
+        if (num_split_keys + 1 >= num_threads * SCAN_PIECES_PER_THREAD) {
+            break;
+        }
+    }
+
+    // piece i covers piece_starts[i] through piece_ends[i]. only separators inside the query's range cut it
+    AggregateScan scan;
+    scan.table = table;
+    scan.piece_starts = malloc((num_split_keys + 1) * sizeof(u_int32_t));
+    scan.piece_ends = malloc((num_split_keys + 1) * sizeof(u_int32_t));
+    scan.num_pieces = 0;
+    scan.next_piece = 0;
+    u_int32_t start = statement->min_id;
+    for (u_int32_t i = 0; i < num_split_keys; i++) {
+        if (split_keys[i] >= start && split_keys[i] < statement->max_id) {
+            scan.piece_starts[scan.num_pieces] = start;
+            scan.piece_ends[scan.num_pieces++] = split_keys[i];
+            start = split_keys[i] + 1;
+        }
+    }
+    scan.piece_starts[scan.num_pieces] = start;
+    scan.piece_ends[scan.num_pieces++] = statement->max_id;
+    free(split_keys);
+
+    if (num_threads > scan.num_pieces) {
+        num_threads = scan.num_pieces;
+    }
+    AggregateWorker workers[MAX_SCAN_THREADS];
+    for (u_int32_t i = 0; i < num_threads; i++) {
+        workers[i].scan = &scan;
+        memset(&workers[i].result, 0, sizeof(AggregateResult));
+    }
+    if (num_threads == 1) {
+        // not worth a thread
+        aggregate_worker_run(&workers[0]);
+    } else {
+        // the main thread just waits, so flipping this around the workers' lifetime can't race with anything. in concurrent
+        // mode it's on all the time anyway, and other threads are looking at it
+        bool shared = pager->shared;
+        if (!shared) {
+            pager->shared = true;
+        }
+        for (u_int32_t i = 0; i < num_threads; i++) {
+            if (pthread_create(&workers[i].thread, NULL, aggregate_worker_run, &workers[i]) != 0) {
+                printf("Error creating scan thread.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (u_int32_t i = 0; i < num_threads; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        if (!shared) {
+            pager->shared = false;
+        }
+    }
+
+    AggregateResult result = { 0 };
+    for (u_int32_t i = 0; i < num_threads; i++) {
+        aggregate_result_merge(&result, &workers[i].result);
+    }
+    free(scan.piece_starts);
+    free(scan.piece_ends);
+
+    print_aggregates(statement, &result);
+    return EXECUTE_SUCCESS;
+}
+
+/**
+ * Text conditions. like understands a % at either end of the value: a trailing one makes it a prefix, a leading one a suffix,
+ * and both a substring. Without one (and for =) the whole value has to match.
+ */
+typedef enum {
+    MATCH_EQUAL,
+    MATCH_PREFIX,
+    MATCH_SUFFIX,
+    MATCH_CONTAINS
+} TextMatch;
+
+typedef struct {
+    IndexColumn column;
+    TextMatch match;
+    const u_int8_t* value;
+    u_int32_t length;
+} TextFilter;
+
+void text_filter_init(TextFilter* filter, Statement* statement) {
+    filter->column = statement->column;
+    filter->match = MATCH_EQUAL;
+    filter->value = (u_int8_t*)statement->where_value;
+    filter->length = strlen(statement->where_value);
+    if (!statement->like) {
+        return;
+    }
+
+    bool leading = filter->length > 0 && filter->value[0] == '%';
+    if (leading) {
+        filter->value++;
+        filter->length--;
+    }
+    bool trailing = filter->length > 0 && filter->value[filter->length - 1] == '%';
+    if (trailing) {
+        filter->length--;
+    }
+    if (leading) {
+        filter->match = trailing ? MATCH_CONTAINS : MATCH_SUFFIX;
+    } else if (trailing) {
+        filter->match = MATCH_PREFIX;
+    }
+}
+
+/**
+ * Whether the first length bytes of a and b are the same. This compares one value at a time, so it does about what memcmp does:
+ * the vector versions check 32 (AVX2) or 16 (SSE2) bytes at once and movemask says if every one of them was equal. They never
+ * load past length, since a value can end right at the end of a page, so whatever is left over after the last full vector goes
+ * through the scalar version. Values are at most 255 bytes, so a scan gains little from them; what makes leaf_node_filter()
+ * cheap is that rows are never decoded.
+ */
+bool bytes_equal_scalar(const u_int8_t* a, const u_int8_t* b, u_int32_t length) {
+    return memcmp(a, b, length) == 0;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+bool bytes_equal_avx2(const u_int8_t* a, const u_int8_t* b, u_int32_t length) {
+    u_int32_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        if ((u_int32_t)_mm256_movemask_epi8(equal) != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8(equal) != 0xFFFF) {
+            return false;
+        }
+    }
+    return bytes_equal_scalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("sse2")))
+bool bytes_equal_sse2(const u_int8_t* a, const u_int8_t* b, u_int32_t length) {
+    u_int32_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        if (_mm_movemask_epi8(equal) != 0xFFFF) {
+            return false;
+        }
+    }
+    return bytes_equal_scalar(a + i, b + i, length - i);
+}
+#endif
+
+// called for every value a scan looks at, so like count_keys_below() it's picked once, by choose_bytes_equal()
+bool (*bytes_equal)(const u_int8_t* a, const u_int8_t* b, u_int32_t length) = bytes_equal_scalar;
+
+void choose_bytes_equal() {
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        bytes_equal = bytes_equal_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        bytes_equal = bytes_equal_sse2;
+    }
+#endif
+}
+
+bool text_filter_matches(TextFilter* filter, const u_int8_t* value, u_int32_t length) {
+    if (length < filter->length) {
+        return false;
+    }
+    switch (filter->match) {
+        case (MATCH_EQUAL):
+            return length == filter->length && bytes_equal(value, filter->value, length);
+        case (MATCH_PREFIX):
+            return bytes_equal(value, filter->value, filter->length);
+        case (MATCH_SUFFIX):
+            return bytes_equal(value + length - filter->length, filter->value, filter->length);
+        case (MATCH_CONTAINS):
+            for (u_int32_t i = 0; i + filter->length <= length; i++) {
+                if (value[i] == filter->value[0] && bytes_equal(value + i, filter->value, filter->length)) {
+                    return true;
+                }
+            }
+            return filter->length == 0;
+    }
+    return false;
+}
+
+// where a column's value sits inside an encoded row (see serialize_row()), and how long it is
+const u_int8_t* encoded_row_column(void* record, IndexColumn column, u_int32_t* length) {
+    u_int8_t* bytes = record + ID_SIZE;
+    if (column == INDEX_EMAIL) {
+        bytes += 1 + bytes[0];
+    }
+    *length = bytes[0];
+    return bytes + 1;
+}
+
+// checks every row of a leaf against the filter right where it's stored, and sets the bit for each cell that passes in
+// selected. nothing gets decoded. returns how many passed
+u_int32_t leaf_node_filter(void* node, TextFilter* filter, u_int64_t* selected) {
+    u_int32_t num_cells = *leaf_node_num_cells(node);
+    u_int16_t* row_offsets = leaf_node_row_offsets(node);
+    memset(selected, 0, (num_cells + 63) / 64 * sizeof(u_int64_t));
+
+    u_int32_t num_selected = 0;
+    for (u_int32_t i = 0; i < num_cells; i++) {
+        u_int32_t length;
+        const u_int8_t* value = encoded_row_column(node + row_offsets[i], filter->column, &length);
+        if (text_filter_matches(filter, value, length)) {
+            selected[i / 64] |= 1ULL << (i % 64);
+            num_selected++;
+        }
+    }
+    return num_selected;
+}
+
+/**
+ * select where username|email = V (or like V). An index on the column answers equality and prefix conditions: the matching
+ * keys are one run of index entries, so a descent finds the first one (the value with id 0), and the leaf chain is followed
+ * until the keys stop matching, each row being looked up by its id. Rows come out ordered by the column. The ids are read out
+ * of the index a batch at a time and the index is let go before the rows are looked up, so a reader in concurrent mode never
+ * waits on the table while it holds part of the index. The next batch starts with a fresh descent, right after the last entry.
+ * Anything else is a scan of the table's leaves. Each leaf is filtered in place into a bitmap of the cells that match, and
+ * only those rows get decoded, so most of a scan is comparing bytes straight out of the pages.
+ */
+ExecuteResult execute_text_select(Statement* statement, Table* table) {
+    Pager* pager = table->pager;
+    TextFilter filter;
+    text_filter_init(&filter, statement);
+    u_int32_t skipped = 0;
+    u_int32_t num_rows = 0;
+    Row row;
+
+    if (__atomic_load_n(&table->index_roots[filter.column], __ATOMIC_ACQUIRE) == 0 || filter.match == MATCH_SUFFIX
+        || filter.match == MATCH_CONTAINS) {
+        u_int64_t selected[(LEAF_NODE_MAX_CELLS + 63) / 64];
+        Cursor* cursor = table_start(table);
+        while (!cursor->end_of_table && num_rows < statement->limit) {
+            void* node = get_page(pager, cursor->page_num);
+            u_int32_t num_selected = leaf_node_filter(node, &filter, selected);
+            for (u_int32_t word = 0; num_selected > 0 && num_rows < statement->limit; word++) {
+                u_int64_t bits = selected[word];
+                while (bits != 0 && num_rows < statement->limit) {
+                    u_int32_t cell = word * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    num_selected--;
+                    // the cursor only starts partway into a leaf when it had to find its place again, and the cells before
+                    // it were seen already
+                    if (cell < cursor->cell_num) {
+                        continue;
+                    }
+                    if (skipped < statement->offset) {
+                        skipped++;
+                        continue;
+                    }
+                    deserialize_row(leaf_node_value(node, cell), &row);
+                    print_row(&row);
+                    num_rows++;
+                }
+            }
+            unpin_page(pager, cursor->page_num);
+            if (num_rows < statement->limit) {
+                cursor_next_leaf(cursor);
+            }
+        }
+        close_cursor(cursor);
+        return EXECUTE_SUCCESS;
+    }
+
+    u_int8_t from_value[COLUMN_EMAIL_SIZE + 1];
+    IndexKey from = { (char*)filter.value, filter.length, 0 };
+    bool after_from = false;    // from was read already, so the batch starts past it
+    bool done = false;
+    u_int32_t ids[INDEX_SELECT_BATCH];
+    while (!done && num_rows < statement->limit) {
+        u_int32_t page_num = index_find_leaf(table, filter.column, &from);
+        void* node = get_page(pager, page_num);
+        u_int32_t cell = index_node_lower_bound(node, &from);
+        if (after_from && cell < *index_node_num_cells(node)) {
+            IndexKey key = index_entry_key(index_entry(node, cell), true);
+            cell += compare_index_keys(&key, &from) == 0;
+        }
+
+        u_int32_t num_ids = 0;
+        u_int32_t busy_page_num = 0;
+        while (num_ids < INDEX_SELECT_BATCH) {
+            if (cell == *index_node_num_cells(node)) {
+                u_int32_t next_page_num = *index_node_link(node);
+                if (next_page_num == 0) {
+                    done = true;
+                    break;
+                }
+                // the same hand-over-hand walk as cursor_next_leaf()
+                if (!try_latch_page(pager, next_page_num)) {
+                    busy_page_num = next_page_num;
+                    break;
+                }
+                void* next = get_page(pager, next_page_num);
+                unpin_page(pager, page_num);
+                unlatch_page(pager, page_num);
+                page_num = next_page_num;
+                node = next;
+                cell = 0;
+                continue;
+            }
+
+            IndexKey key = index_entry_key(index_entry(node, cell), true);
+            if (!text_filter_matches(&filter, (u_int8_t*)key.value, key.length)) {
+                done = true;
+                break;
+            }
+            ids[num_ids++] = key.id;
+            memcpy(from_value, key.value, key.length);
+            from.value = (char*)from_value;
+            from.length = key.length;
+            from.id = key.id;
+            after_from = true;
+            cell++;
+        }
+        unpin_page(pager, page_num);
+        unlatch_page(pager, page_num);
+        if (busy_page_num != 0) {
+            wait_for_page(pager, busy_page_num);
+        }
+
+        for (u_int32_t i = 0; i < num_ids && num_rows < statement->limit; i++) {
+            if (skipped < statement->offset) {
+                skipped++;
+                continue;
+            }
+            Cursor* cursor = table_find(table, ids[i]);
+            void* leaf = get_page(pager, cursor->page_num);
+            // in concurrent mode a write can slip in between reading the index and getting here. it may have taken the row
+            // away or changed it
+            bool found = cursor->cell_num < *leaf_node_num_cells(leaf) && *leaf_node_key(leaf, cursor->cell_num) == ids[i];
+            if (found) {
+                u_int32_t length;
+                const u_int8_t* value = encoded_row_column(leaf_node_value(leaf, cursor->cell_num), filter.column, &length);
+                found = text_filter_matches(&filter, value, length);
+            }
+            if (found) {
+                deserialize_row(leaf_node_value(leaf, cursor->cell_num), &row);
+                print_row(&row);
+                num_rows++;
+            }
+            unpin_page(pager, cursor->page_num);
+            close_cursor(cursor);
+        }
+    }
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_select(Statement* statement, Table* table) {
+    if (statement->num_aggregates > 0) {
+        return execute_aggregate(statement, table);
+    }
+    if (statement->text_where) {
+        return execute_text_select(statement, table);
+    }
+
+    Row row;
+    // for (uint32_t i = 0; i < table->num_rows; i++) {
+    //     deserialize_row(row_slot(table, i), &row);
+    //     print_row(&row);
+    // }
+
+    // seek to the first id in range and follow the leaf chain until we pass the end of it or hit the limit. an offset is skipped
+    // by position, straight from the row counts, rather than by stepping over rows
+    Cursor* cursor;
+    if (statement->offset > 0) {
+        u_int64_t position = (u_int64_t)table_rank(table, statement->min_id) + statement->offset;
+        cursor = table_seek_nth(table, position > UINT32_MAX ? UINT32_MAX : position);
+    } else {
+        cursor = table_seek(table, statement->min_id);
+    }
+    u_int32_t num_rows = 0;
+    while (!(cursor->end_of_table) && num_rows < statement->limit) {
+        deserialize_row(cursor_value(cursor), &row);
+        if (row.id > statement->max_id) {
+            break;
+        }
+        print_row(&row);
+        num_rows++;
+        cursor_advance(cursor);
+    }
+
+    close_cursor(cursor);
+
+    return EXECUTE_SUCCESS;
+}
+
+// deletes every row in the statement's key range. each one is looked up from the root again, since rebalancing after a delete
+// can move rows between leaves
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+    u_int32_t key = statement->min_id;
+    while (true) {
+        Cursor* cursor = table_seek(table, key);
+        bool end_of_table = cursor->end_of_table;
+        if (!end_of_table) {
+            void* node = get_page(table->pager, cursor->page_num);
+            key = *leaf_node_key(node, cursor->cell_num);
+            unpin_page(table->pager, cursor->page_num);
+        }
+        close_cursor(cursor);
+        if (end_of_table || key > statement->max_id) {
+            break;
+        }
+
+        table_delete(table, key);
+        if (key == statement->max_id) {
+            break;
+        }
+        key++;
+    }
+
+    return EXECUTE_SUCCESS;
+}
+
+// rewrites a row where it is. the tree only changes shape in the rare case that a row grew too big for its leaf, which then
+// splits like it would on an insert
+ExecuteResult execute_update(Statement* statement, Table* table) {
+    Pager* pager = table->pager;
+    u_int32_t key = statement->row_to_insert.id;
+    Cursor* cursor = table_find(table, key);
+
+    void* node = get_page(pager, cursor->page_num);
+    if (cursor->cell_num >= *leaf_node_num_cells(node) || *leaf_node_key(node, cursor->cell_num) != key) {
+        unpin_page(pager, cursor->page_num);
+        close_cursor(cursor);
+        return EXECUTE_KEY_NOT_FOUND;
+    }
+
+    Row row;
+    deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+    Row old_row = row;
+    if (statement->set_username) {
+        strcpy(row.username, statement->row_to_insert.username);
+    }
+    if (statement->set_email) {
+        strcpy(row.email, statement->row_to_insert.email);
+    }
+    u_int8_t record[ROW_SIZE];
+    u_int32_t size = serialize_row(&row, record);
+
+    if (leaf_node_update_record(node, cursor->cell_num, record, size)) {
+        mark_page_dirty(pager, cursor->page_num);
+        unpin_page(pager, cursor->page_num);
+    } else {
+        leaf_node_delete_cell(node, cursor->cell_num);
+        mark_page_dirty(pager, cursor->page_num);
+        unpin_page(pager, cursor->page_num);
+        add_row_counts(pager, cursor->page_num, -1);
+        leaf_node_insert(cursor, key, &row);
+    }
+    close_cursor(cursor);
+
+    // an index only changes if its column did
+    for (u_int32_t column = 0; column < NUM_INDEX_COLUMNS; column++) {
+        IndexKey old_key = index_key_for_row(column, &old_row);
+        IndexKey new_key = index_key_for_row(column, &row);
+        if (table->index_roots[column] != 0 && compare_index_keys(&old_key, &new_key) != 0) {
+            index_delete(table, column, &old_key);
+            index_insert(table, column, &new_key);
+        }
+    }
+
+    return EXECUTE_SUCCESS;
+}
+
+// builds an index on the statement's column from the rows already there. a column that has one already is left alone
+ExecuteResult execute_create_index(Statement* statement, Table* table) {
+    if (table->index_roots[statement->column] != 0) {
+        return EXECUTE_SUCCESS;
+    }
+
+    Pager* pager = table->pager;
+    u_int32_t root_page_num = get_unused_page_num(pager);
+    void* root = get_page(pager, root_page_num);
+    initialize_index_node(root, true);
+    set_node_root(root, true);
+    *node_parent(root) = 0;
+    mark_page_dirty(pager, root_page_num);
+    unpin_page(pager, root_page_num);
+    set_index_root(table, statement->column, root_page_num);
+
+    index_build(table, statement->column);
+    return EXECUTE_SUCCESS;
+}
+
+// every statement runs as its own transaction, committed to the log as soon as it finishes
+ExecuteResult execute_statement(Statement* statement, Table* table) {
+    Pager* pager = table->pager;
+    // in concurrent mode a write statement waits for the one before it to finish, and latches what it touches (see get_page())
+    bool writes = statement->type != STATEMENT_SELECT;
+    if (pager->concurrent && writes) {
+        pthread_mutex_lock(&table->writer);
+        writing_pager = pager;
+    }
+
+    ExecuteResult result;
+    switch (statement->type) {
+        case (STATEMENT_INSERT):
+            result = execute_insert(statement, table);
+            break;
+        case (STATEMENT_SELECT):
+            result = execute_select(statement, table);
+            break;
+        case (STATEMENT_DELETE):
+            result = execute_delete(statement, table);
+            break;
+        case (STATEMENT_UPDATE):
+            result = execute_update(statement, table);
+            break;
+        case (STATEMENT_CREATE_INDEX):
+            result = execute_create_index(statement, table);
+            break;
+        default:
+            printf("Unknown statement type %d\n", statement->type);
+            exit(EXIT_FAILURE);
+    }
+
+    if (!pager->concurrent) {
+        pager_commit(pager);
+    } else if (writes) {
+        // the log and the pool are shared with the readers. the page latches only go once the statement is in the log
+        pthread_mutex_lock(&pager->latch);
+        pager_commit(pager);
+        pager_maybe_checkpoint(pager);
+        pthread_mutex_unlock(&pager->latch);
+        release_write_latches(pager);
+        writing_pager = NULL;
+        pthread_mutex_unlock(&table->writer);
+    }
+    return result;
+}
+
+// print prompt to the output to indicate user input
+void print_prompt() { printf("db > "); }
+
+// Reads and stores user input. returns false once the input runs out
+bool read_input(InputBuffer* input_buffer, FILE* input) {
+    // Uses getline() to store input into buffer, buffer size stored as well
+    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), input);
+
+    if (bytes_read <= 0) {
+        return false;
+    }
+
+    // Ignore trailing newline or whateva. the last line of a script might not have one
+    if (input_buffer->buffer[bytes_read - 1] == '\n') {
+        bytes_read -= 1;
+    }
+    input_buffer->input_length = bytes_read;
+    input_buffer->buffer[bytes_read] = 0;
+    return true;
+}
+
+// how the statements of a batch run turned out, printed as one line at the end
+typedef struct {
+    u_int32_t executed;
+    u_int32_t duplicate_key;
+    u_int32_t key_not_found;
+    u_int32_t table_full;
+    u_int32_t rejected;     // statements that didn't parse
+} BatchSummary;
+
+void print_batch_summary(BatchSummary* summary) {
+    printf("Batch: %u executed, %u duplicate key, %u key not found, %u table full, %u rejected.\n", summary->executed,
+           summary->duplicate_key, summary->key_not_found, summary->table_full, summary->rejected);
+}
+
+/**
+ * The REPL's prepared statements, kept by name:
+ *
+ *     prepare <name> as <statement with ?s>
+ *     execute <name> <value> <value> ...
+ *     deallocate <name>
+ *
+ * execute takes one value per ?, in order, and runs the statement with them like it had been typed out.
+ */
+typedef struct {
+    char* name;
+    Statement statement;
+} NamedStatement;
+
+typedef struct {
+    NamedStatement* statements;
+    u_int32_t num_statements;
+} NamedStatements;
+
+NamedStatement* find_named_statement(NamedStatements* named, const char* name) {
+    for (u_int32_t i = 0; i < named->num_statements; i++) {
+        if (strcmp(named->statements[i].name, name) == 0) {
+            return &named->statements[i];
         }
     }
-
-    *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cursor->cell_num));
+    return NULL;
 }
 
-// flushes page cache to disk, closes database file, and frees memory allocated for Pager and Table data structures
-void db_close(Table* table) {
-    Pager* pager = table->pager;
+// token after the one strtok last returned, where an unparsed tail of the input starts
+char* rest_of_input(InputBuffer* input_buffer, char* token) {
+    char* rest = token + strlen(token);
+    return rest < input_buffer->buffer + input_buffer->input_length ? rest + 1 : rest;
+}
 
-    for (u_int32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+// prepare <name> as <statement>. preparing a name again replaces what it had
+PrepareResult prepare_named(NamedStatements* named, InputBuffer* input_buffer) {
+    strtok(input_buffer->buffer, " ");
+    char* name = strtok(NULL, " ");
+    char* as = strtok(NULL, " ");
+    if (name == NULL || as == NULL || strcmp(as, "as") != 0) {
+        return PREPARE_SYNTAX_ERROR;
     }
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        printf("Error closing db file.\n");
-        exit(EXIT_FAILURE);
-    }
-    for (u_int32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        void* page = pager->pages[i];
-        if (page) {
-            free(page);
-            pager->pages[i] = NULL;
-        }
+    InputBuffer statement_input;
+    statement_input.buffer = rest_of_input(input_buffer, as);
+    statement_input.input_length = strlen(statement_input.buffer);
+    statement_input.buffer_length = statement_input.input_length + 1;
+    Statement statement;
+    PrepareResult result = prepare_statement(&statement_input, &statement);
+    if (result != PREPARE_SUCCESS) {
+        free_statement(&statement);
+        return result;
     }
 
-    free(pager);
-    free(table);
+    NamedStatement* existing = find_named_statement(named, name);
+    if (existing != NULL) {
+        free_statement(&existing->statement);
+        existing->statement = statement;
+        return PREPARE_SUCCESS;
+    }
+    named->statements = realloc(named->statements, (named->num_statements + 1) * sizeof(NamedStatement));
+    named->statements[named->num_statements].name = strdup(name);
+    named->statements[named->num_statements].statement = statement;
+    named->num_statements++;
+    return PREPARE_SUCCESS;
 }
 
-// method for initializing an InputBuffer object
-InputBuffer* new_input_buffer() {
-    InputBuffer* input_buffer = malloc(sizeof(InputBuffer));
-    input_buffer->buffer = NULL;
-    input_buffer->buffer_length = 0;
-    input_buffer->input_length = 0;
+// execute <name> <values...>. binds the values and hands back the statement, ready to run
+PrepareResult bind_named(NamedStatements* named, InputBuffer* input_buffer, Statement** statement) {
+    strtok(input_buffer->buffer, " ");
+    char* name = strtok(NULL, " ");
+    if (name == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    NamedStatement* found = find_named_statement(named, name);
+    if (found == NULL) {
+        return PREPARE_NO_SUCH_STATEMENT;
+    }
 
-    return input_buffer;
+    u_int32_t num_values = 0;
+    char* value;
+    while ((value = strtok(NULL, " ")) != NULL) {
+        if (num_values >= found->statement.num_params) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = statement_bind(&found->statement, num_values++, value);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+    if (num_values != found->statement.num_params) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *statement = &found->statement;
+    return PREPARE_SUCCESS;
 }
 
-void close_input_buffer(InputBuffer* input_buffer) {
-    free(input_buffer->buffer);
-    free(input_buffer);
+// deallocate <name>
+PrepareResult deallocate_named(NamedStatements* named, InputBuffer* input_buffer) {
+    strtok(input_buffer->buffer, " ");
+    char* name = strtok(NULL, " ");
+    if (name == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    NamedStatement* found = find_named_statement(named, name);
+    if (found == NULL) {
+        return PREPARE_NO_SUCH_STATEMENT;
+    }
+    free(found->name);
+    free_statement(&found->statement);
+    *found = named->statements[--named->num_statements];
+    return PREPARE_SUCCESS;
 }
 
-// helper function for print_tree(). taking the tree level as input, it indents before printing the node based on how deep it is in the tree
-void indent(u_int32_t level) {
-    for (u_int32_t i = 0; i < level; i++) {
-        printf("  ");
+void print_prepare_error(PrepareResult result, InputBuffer* input_buffer) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            break;
+        case (PREPARE_NEGATIVE_ID):
+            fprintf(results(), "ID must be positive.\n");
+            break;
+        case (PREPARE_STRING_TOO_LONG):
+            fprintf(results(), "String is too long.\n");
+            break;
+        case (PREPARE_SYNTAX_ERROR):
+            fprintf(results(), "Syntax error. Could not parse statement.\n");
+            break;
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            fprintf(results(), "Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
+            break;
+        case (PREPARE_NO_SUCH_STATEMENT):
+            fprintf(results(), "Error: No such prepared statement.\n");
+            break;
     }
 }
 
-// recursively prints nodes.. prints each node and its children
-void print_tree(Pager* pager, u_int32_t page_num, u_int32_t indentation_level) {
-    void* node = get_page(pager, page_num);
-    u_int32_t num_keys, child;
+/**
+ * Runs a line that isn't a meta command: a statement, or the prepare/execute/deallocate of a named one. Whatever it prints
+ * goes to results(), and summary counts how it turned out. quiet leaves out "Prepared." and "Executed." (batch mode).
+ */
+void run_input(InputBuffer* input_buffer, Table* table, NamedStatements* named, BatchSummary* summary, bool quiet) {
+    FILE* out = results();
+
+    // prepare and deallocate only touch the named statements. execute runs one of them, anything else is parsed fresh
+    Statement parsed;
+    Statement* statement = NULL;
+    PrepareResult prepared;
+    if (strncmp(input_buffer->buffer, "prepare ", 8) == 0 || strncmp(input_buffer->buffer, "deallocate ", 11) == 0) {
+        bool prepare = input_buffer->buffer[0] == 'p';
+        prepared = prepare ? prepare_named(named, input_buffer) : deallocate_named(named, input_buffer);
+        if (prepared != PREPARE_SUCCESS) {
+            print_prepare_error(prepared, input_buffer);
+            summary->rejected++;
+        } else if (!quiet) {
+            fprintf(out, prepare ? "Prepared.\n" : "Deallocated.\n");
+        }
+        return;
+    } else if (strncmp(input_buffer->buffer, "execute ", 8) == 0) {
+        prepared = bind_named(named, input_buffer, &statement);
+    } else {
+        prepared = prepare_statement(input_buffer, &parsed);
+        statement = &parsed;
+        // ?s only make sense in a prepared statement
+        if (prepared == PREPARE_SUCCESS && parsed.num_params > 0) {
+            prepared = PREPARE_SYNTAX_ERROR;
+        }
+    }
+    if (prepared != PREPARE_SUCCESS) {
+        print_prepare_error(prepared, input_buffer);
+        if (statement == &parsed) {
+            free_statement(&parsed);
+        }
+        summary->rejected++;
+        return;
+    }
 
-    switch (get_node_type(node)) {
-        case (NODE_LEAF):
-            num_keys = *leaf_node_num_cells(node);
-            indent(indentation_level);
-            printf("- leaf (size %d)\n", num_keys);
-            for (u_int32_t i = 0; i < num_keys; i++) {
-                indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
+    switch(execute_statement(statement, table)) {
+        case (EXECUTE_SUCCESS):
+            if (!quiet) {
+                fprintf(out, "Executed.\n");
             }
+            summary->executed++;
             break;
-        case (NODE_INTERNAL):
-            num_keys = *internal_node_num_keys(node);
-            indent(indentation_level);
-            printf("- internal (size %d)\n", num_keys);
-            for (u_int32_t i = 0; i < num_keys; i++) {
-                child = *internal_node_child(node, i);
-                print_tree(pager, child, indentation_level + 1);
-
-                indent(indentation_level + 1);
-                printf("- key %d\n", *internal_node_key(node, i));
-            }
-            child = *internal_node_right_child(node);
-            print_tree(pager, child, indentation_level + 1);
+        case (EXECUTE_DUPLICATE_KEY):
+            fprintf(out, "Error: Duplicate key.\n");
+            summary->duplicate_key++;
+            break;
+        case (EXECUTE_KEY_NOT_FOUND):
+            fprintf(out, "Error: Key not found.\n");
+            summary->key_not_found++;
+            break;
+        case (EXECUTE_TABLE_FULL):
+            fprintf(out, "Error: Table full.\n");
+            summary->table_full++;
             break;
     }
-}
+    if (statement == &parsed) {
+        free_statement(&parsed);
+    }
 
-// print out all constants
-void print_constants() {
-    printf("ROW_SIZE: %d\n", ROW_SIZE);
-    printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-    printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-    printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-    printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+    pager_maybe_checkpoint(table->pager);
 }
 
-// parse meta commands
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
-    if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
-        printf("Tree:\n");
-        print_tree(table->pager, 0, 0);
-        return META_COMMAND_SUCCESS;
-    } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
-        printf("Constants:\n");
-        print_constants();
-        return META_COMMAND_SUCCESS;
-    } else {
-        return META_COMMAND_UNRECOGNIZED_COMMAND;
+void free_named_statements(NamedStatements* named) {
+    for (u_int32_t i = 0; i < named->num_statements; i++) {
+        free(named->statements[i].name);
+        free_statement(&named->statements[i].statement);
     }
+    free(named->statements);
+    named->statements = NULL;
+    named->num_statements = 0;
 }
 
-// a function that checks the input for proper formatting + length, and then prepping the statement for an insertion command
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-    statement->type = STATEMENT_INSERT;
+/**
+ * Server mode (--listen) takes statements over a socket instead of stdin. A single thread runs an epoll loop over all the
+ * connections, so statements still run one at a time, in the order their lines come in, same as at the prompt.
+ *
+ * A client sends one line per statement, just like it would type it (prepare/execute/deallocate work too, with names kept
+ * per connection). Every line gets exactly one reply:
+ *
+ *     <length>\n<what the REPL would have printed for the line>
+ *
+ * where length counts the bytes after that first newline. A client doesn't have to wait for a reply before sending the next
+ * line; replies come back in the order the lines went out. .exit closes the connection, other meta commands aren't available
+ * over a socket.
+ */
+typedef struct {
+    int fd;
+    char* input;              // received and not run yet, ends with a partial line if there is one
+    size_t input_length;
+    size_t input_capacity;
+    char* output;             // replies still to be sent are the bytes from output_start to output_length
+    size_t output_start;
+    size_t output_length;
+    size_t output_capacity;
+    u_int32_t events;         // what epoll is watching the connection for
+    bool hung_up;             // the client won't send anything more
+    bool closing;             // close as soon as the replies are out
+    NamedStatements named;
+} Connection;
+
+// set by SIGINT or SIGTERM, stops the server loop
+volatile sig_atomic_t server_stopping = 0;
+
+void server_stop(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
 
+// a path (anything with a '/' in it) is a unix socket. otherwise it's a TCP port on localhost, or host:port
+bool is_unix_socket_address(const char* address) {
+    return strchr(address, '/') != NULL;
+}
 
-    // strtok points at the beginning of the string on the first call, tokenizes the string
-    // subsequent calls of strtok require NULL pointers and tokenize the next tokens starting with the first non-delimiter and ending with delimiter
-    char* keyword = strtok(input_buffer->buffer, " ");
-    char* id_string = strtok(NULL, " ");
-    char* username = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
+int server_listen(const char* address) {
+    int fd;
+    if (is_unix_socket_address(address)) {
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(unix_address.sun_path)) {
+            printf("Socket path '%s' is too long.\n", address);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(unix_address.sun_path, address);
+        // a socket left behind by a server that didn't get to clean up would make bind() fail
+        struct stat socket_stat;
+        if (stat(address, &socket_stat) == 0 && S_ISSOCK(socket_stat.st_mode)) {
+            unlink(address);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1 || bind(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) == -1) {
+            printf("Unable to listen on '%s': %s\n", address, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // without a host only this machine can connect, there's no authentication of any kind
+        char host[256] = "127.0.0.1";
+        const char* port = address;
+        const char* colon = strrchr(address, ':');
+        if (colon != NULL) {
+            const char* host_start = address;
+            size_t host_length = colon - address;
+            // [::1]:5000
+            if (host_length >= 2 && address[0] == '[' && colon[-1] == ']') {
+                host_start++;
+                host_length -= 2;
+            }
+            if (host_length >= sizeof(host)) {
+                printf("Host in '%s' is too long.\n", address);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(host, host_start, host_length);
+            host[host_length] = 0;
+            port = colon + 1;
+        }
 
-    if (id_string == NULL || username == NULL || email == NULL) {
-        return PREPARE_SYNTAX_ERROR;
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo* found;
+        int error = getaddrinfo(host, port, &hints, &found);
+        if (error != 0) {
+            printf("Unable to listen on '%s': %s\n", address, gai_strerror(error));
+            exit(EXIT_FAILURE);
+        }
+        fd = socket(found->ai_family, found->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, found->ai_protocol);
+        int on = 1;
+        if (fd == -1 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+            || bind(fd, found->ai_addr, found->ai_addrlen) == -1) {
+            printf("Unable to listen on '%s': %s\n", address, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        freeaddrinfo(found);
     }
 
-    int id = atoi(id_string);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
-    }
-    if (strlen(username) > COLUMN_USERNAME_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
-    }
-    if (strlen(email) > COLUMN_EMAIL_SIZE) {
-        return PREPARE_STRING_TOO_LONG;
+    if (listen(fd, SOMAXCONN) == -1) {
+        printf("Unable to listen on '%s': %s\n", address, strerror(errno));
+        exit(EXIT_FAILURE);
     }
+    return fd;
+}
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+size_t connection_pending_output(Connection* connection) {
+    return connection->output_length - connection->output_start;
+}
 
-    return PREPARE_SUCCESS;
+bool connection_has_line(Connection* connection) {
+    return memchr(connection->input, '\n', connection->input_length) != NULL;
 }
 
-// parse sql commands
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert(input_buffer, statement);
+void connection_send_later(Connection* connection, const char* bytes, size_t length) {
+    size_t pending = connection_pending_output(connection);
+    if (connection->output_length + length > connection->output_capacity) {
+        // what's been sent makes room first, the buffer only grows when that's not enough
+        if (pending > 0) {
+            memmove(connection->output, connection->output + connection->output_start, pending);
+        }
+        connection->output_start = 0;
+        connection->output_length = pending;
+        if (pending + length > connection->output_capacity) {
+            size_t capacity = connection->output_capacity == 0 ? SERVER_READ_SIZE : connection->output_capacity * 2;
+            while (capacity < pending + length) {
+                capacity *= 2;
+            }
+            connection->output = realloc(connection->output, capacity);
+            connection->output_capacity = capacity;
+        }
     }
+    memcpy(connection->output + connection->output_length, bytes, length);
+    connection->output_length += length;
+}
 
-    if (strcmp(input_buffer->buffer, "select") == 0) {
-        statement->type = STATEMENT_SELECT;
-        return PREPARE_SUCCESS;
+// runs the complete lines that have come in, in order, until the replies waiting to go out get to be too much
+void connection_run(Connection* connection, Table* table) {
+    size_t start = 0;
+    while (!connection->closing && connection_pending_output(connection) < SERVER_MAX_PENDING_OUTPUT) {
+        char* line_start = connection->input + start;
+        char* newline = memchr(line_start, '\n', connection->input_length - start);
+        if (newline == NULL) {
+            break;
+        }
+        start = newline - connection->input + 1;
+        *newline = 0;
+        // clients like telnet end their lines with \r\n
+        if (newline > line_start && newline[-1] == '\r') {
+            *--newline = 0;
+        }
+        InputBuffer line;
+        line.buffer = line_start;
+        line.input_length = newline - line_start;
+        line.buffer_length = line.input_length + 1;
+
+        char* reply;
+        size_t reply_length;
+        result_output = open_memstream(&reply, &reply_length);
+        if (line.buffer[0] == '.') {
+            if (strcmp(line.buffer, ".exit") == 0) {
+                connection->closing = true;
+            } else {
+                fprintf(result_output, "Unrecognized command '%s'\n", line.buffer);
+            }
+        } else {
+            BatchSummary summary = { 0 };
+            run_input(&line, table, &connection->named, &summary, false);
+        }
+        fclose(result_output);
+        result_output = NULL;
+
+        if (!connection->closing) {
+            char header[24];
+            int header_length = snprintf(header, sizeof(header), "%zu\n", reply_length);
+            connection_send_later(connection, header, header_length);
+            connection_send_later(connection, reply, reply_length);
+        }
+        free(reply);
     }
 
-    return PREPARE_UNRECOGNIZED_STATEMENT;
+    memmove(connection->input, connection->input + start, connection->input_length - start);
+    connection->input_length -= start;
 }
 
-// execute the insert command!! takes the information (id, username, email) from the statement and inserts it into the table
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-    void* node = get_page(table->pager, table->root_page_num);
-    u_int32_t num_cells = (*leaf_node_num_cells(node));
-
-    Row* row_to_insert = &(statement->row_to_insert);
-    u_int32_t key_to_insert = row_to_insert->id;
-    Cursor* cursor = table_find(table, key_to_insert);
-
-    if (cursor->cell_num < num_cells) {
-        u_int32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-        if (key_at_index == key_to_insert) {
-            return EXECUTE_DUPLICATE_KEY;
+// reads whatever has come in. false if the connection is broken
+bool connection_read(Connection* connection) {
+    if (connection->input_length + SERVER_READ_SIZE > connection->input_capacity) {
+        connection->input_capacity = connection->input_length + SERVER_READ_SIZE;
+        connection->input = realloc(connection->input, connection->input_capacity);
+    }
+    ssize_t received = recv(connection->fd, connection->input + connection->input_length, SERVER_READ_SIZE, 0);
+    if (received == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    }
+    if (received == 0) {
+        // whatever's left is the last line, even without a newline (like the last line of a script)
+        connection->hung_up = true;
+        if (connection->input_length > 0 && connection->input[connection->input_length - 1] != '\n') {
+            connection->input[connection->input_length++] = '\n';
         }
+        return true;
     }
-
-    leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-    free(cursor);
-
-    return EXECUTE_SUCCESS;
+    connection->input_length += received;
+    // a line this long isn't a statement, and keeping all of it around could take any amount of memory
+    if (connection->input_length > SERVER_MAX_LINE && !connection_has_line(connection)) {
+        return false;
+    }
+    return true;
 }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
-    Row row;
-    // for (uint32_t i = 0; i < table->num_rows; i++) {
-    //     deserialize_row(row_slot(table, i), &row);
-    //     print_row(&row);
-    // }
-
-    Cursor* cursor = table_start(table);
-    while (!(cursor->end_of_table)) {
-        deserialize_row(cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+// sends as much of the replies as the socket takes. false if the connection is broken
+bool connection_flush(Connection* connection) {
+    while (connection_pending_output(connection) > 0) {
+        ssize_t sent = send(connection->fd, connection->output + connection->output_start, connection_pending_output(connection),
+                            MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection->output_start += sent;
     }
+    connection->output_start = 0;
+    connection->output_length = 0;
+    return true;
+}
 
-    free(cursor);
+void connection_close(int epoll_fd, Connection* connection) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    free_named_statements(&connection->named);
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
 
-    return EXECUTE_SUCCESS;
+// reading stops while too many replies wait to be sent, and writability only matters when there's something to send
+void connection_update_events(int epoll_fd, Connection* connection) {
+    u_int32_t events = 0;
+    if (!connection->hung_up && !connection->closing && connection_pending_output(connection) < SERVER_MAX_PENDING_OUTPUT) {
+        events |= EPOLLIN;
+    }
+    if (connection_pending_output(connection) > 0) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = connection;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
 }
 
-ExecuteResult execute_statement(Statement* statement, Table* table) {
-    switch (statement->type) {
-        case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
-        case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+void server_accept(int epoll_fd, int listener, bool tcp) {
+    while (true) {
+        int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        // replies are small and clients wait on them, Nagle's algorithm would only hold them back
+        if (tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fd = fd;
+        connection->events = EPOLLIN;
+        struct epoll_event event;
+        event.events = connection->events;
+        event.data.ptr = connection;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
     }
 }
 
-// print prompt to the output to indicate user input
-void print_prompt() { printf("db > "); }
+void server_handle(int epoll_fd, Connection* connection, u_int32_t events, Table* table) {
+    bool alive = true;
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (connection->events & EPOLLIN)) {
+        alive = connection_read(connection);
+    }
+    // sending replies can make room for lines that were held back, and those won't come with an event of their own
+    while (alive) {
+        connection_run(connection, table);
+        alive = connection_flush(connection);
+        if (connection->closing || connection_pending_output(connection) >= SERVER_MAX_PENDING_OUTPUT
+            || !connection_has_line(connection)) {
+            break;
+        }
+    }
+    if (alive && connection->hung_up && connection->input_length == 0) {
+        connection->closing = true;
+    }
 
-// Reads and stores user input
-void read_input(InputBuffer* input_buffer) {
-    // Uses getline() to store input into buffer, buffer size stored as well, and we're reading from stdin
-    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+    if (!alive || (connection->closing && connection_pending_output(connection) == 0)) {
+        connection_close(epoll_fd, connection);
+    } else {
+        connection_update_events(epoll_fd, connection);
+    }
+}
 
-    if (bytes_read <= 0) {
-        printf("Error reading input\n");
+// runs until SIGINT or SIGTERM, then returns so the database can be closed properly
+void server_run(Table* table, const char* address) {
+    bool tcp = !is_unix_socket_address(address);
+    int listener = server_listen(address);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        printf("Unable to create epoll instance: %s\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &event);
+
+    // no SA_RESTART, so a signal also wakes up epoll_wait()
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = server_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Listening on %s\n", address);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stopping) {
+        int num_events = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, SERVER_TICK_MS);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("epoll_wait failed: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.ptr == NULL) {
+                server_accept(epoll_fd, listener, tcp);
+            } else {
+                server_handle(epoll_fd, events[i].data.ptr, events[i].events, table);
+            }
+        }
+        // an idle server runs no statements, so the checkpoint timer gets checked here too
+        pager_maybe_checkpoint(table->pager);
+    }
 
-    // Ignore trailing newline or whateva
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = 0;
+    close(listener);
+    if (!tcp) {
+        unlink(address);
+    }
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    DbOptions options;
+    options.num_frames = DEFAULT_POOL_FRAMES;
+    options.checkpoint_pages = DEFAULT_CHECKPOINT_PAGES;
+    options.checkpoint_seconds = DEFAULT_CHECKPOINT_SECONDS;
+    options.use_wal = true;
+    options.use_mmap = false;
+    options.wal_group = DEFAULT_WAL_GROUP;
+    options.fill_factor = DEFAULT_FILL_FACTOR;
+    options.sort_memory_kb = DEFAULT_SORT_MEMORY_KB;
+    options.use_io_uring = true;
+    options.page_size = DEFAULT_PAGE_SIZE;
+    // only programs that share the database between threads turn this on, see "Concurrent mode"
+    options.concurrent = false;
+    // one thread per core for aggregate queries, unless told otherwise
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    options.num_threads = num_cores < 1 ? 1 : num_cores > MAX_SCAN_THREADS ? MAX_SCAN_THREADS : num_cores;
+    char* filename = NULL;
+    bool batch = false;
+    char* script_filename = NULL;
+    char* listen_address = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            options.num_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-pages") == 0 && i + 1 < argc) {
+            options.checkpoint_pages = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint-seconds") == 0 && i + 1 < argc) {
+            options.checkpoint_seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--wal-group") == 0 && i + 1 < argc) {
+            options.wal_group = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fill-factor") == 0 && i + 1 < argc) {
+            options.fill_factor = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+            options.page_size = atoi(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "--sort-memory") == 0 && i + 1 < argc) {
+            options.sort_memory_kb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-wal") == 0) {
+            options.use_wal = false;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            options.use_mmap = true;
+        } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+            options.use_io_uring = false;
+        } else if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+            batch = true;
+        } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            batch = true;
+            script_filename = argv[++i];
+        } else if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_address = argv[++i];
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    if (filename == NULL) {
         printf("Must supply a database filename.\n");
         exit(EXIT_FAILURE);
     }
+    if (options.num_frames < MIN_POOL_FRAMES) {
+        printf("Buffer pool needs at least %d frames.\n", MIN_POOL_FRAMES);
+        exit(EXIT_FAILURE);
+    }
+    if (options.wal_group < 1) {
+        printf("WAL group needs at least 1 commit.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.num_threads < 1 || options.num_threads > MAX_SCAN_THREADS) {
+        printf("Threads must be between 1 and %d.\n", MAX_SCAN_THREADS);
+        exit(EXIT_FAILURE);
+    }
 
-    char* filename = argv[1];
-    Table* table = db_open(filename);
+    if (options.fill_factor < 10 || options.fill_factor > 100) {
+        printf("Fill factor must be between 10 and 100.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!valid_page_size(options.page_size)) {
+        printf("Page size must be a power of two between %d and %d KB.\n", MIN_PAGE_SIZE / 1024, MAX_PAGE_SIZE / 1024);
+        exit(EXIT_FAILURE);
+    }
+
+    /**
+     * Batch mode reads statements from a script (or stdin) without prompts, and its output goes out in big chunks rather than
+     * a write per line. Statements that succeed don't print "Executed." (the summary line at the end counts them), errors and
+     * selected rows still show up. Running out of input ends it like .exit would.
+     */
+    FILE* input = stdin;
+    if (script_filename != NULL) {
+        input = fopen(script_filename, "r");
+        if (input == NULL) {
+            printf("Unable to open script '%s'.\n", script_filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (batch) {
+        setvbuf(stdout, NULL, _IOFBF, BATCH_OUTPUT_BUFFER_SIZE);
+    }
+    BatchSummary summary = { 0 };
+    NamedStatements named = { NULL, 0 };
+
+    Table* table = db_open(filename, &options);
+
+    if (listen_address != NULL) {
+        server_run(table, listen_address);
+        db_close(table);
+        exit(EXIT_SUCCESS);
+    }
 
     InputBuffer* input_buffer = new_input_buffer();
     while(true) {
-        print_prompt();
-        read_input(input_buffer);
+        if (!batch) {
+            print_prompt();
+        }
+        if (!read_input(input_buffer, input)) {
+            if (!batch) {
+                printf("Error reading input\n");
+                exit(EXIT_FAILURE);
+            }
+            print_batch_summary(&summary);
+            db_close(table);
+            exit(EXIT_SUCCESS);
+        }
 
         if (input_buffer->buffer[0] == '.') {
             switch (do_meta_command(input_buffer, table)) {
                 case (META_COMMAND_SUCCESS):
                     continue;
+                case (META_COMMAND_EXIT):
+                    if (batch) {
+                        print_batch_summary(&summary);
+                    }
+                    db_close(table);
+                    exit(EXIT_SUCCESS);
                 case (META_COMMAND_UNRECOGNIZED_COMMAND):
                     printf("Unrecognized command '%s'\n", input_buffer->buffer);
                     continue;
             }
         }
 
-        Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-            case (PREPARE_SUCCESS):
-                break;
-            case (PREPARE_NEGATIVE_ID):
-                printf("ID must be positive.\n");
-                continue;
-            case (PREPARE_STRING_TOO_LONG):
-                printf("String is too long.\n");
-                continue;
-            case (PREPARE_SYNTAX_ERROR):
-                printf("Syntax error. Could not parse statement.\n");
-                continue;
-            case (PREPARE_UNRECOGNIZED_STATEMENT):
-                printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
-                continue;
-        }
-
-        switch(execute_statement(&statement, table)) {
-            case (EXECUTE_SUCCESS):
-                printf("Executed.\n");
-                break;
-            case (EXECUTE_DUPLICATE_KEY):
-                printf("Error: Duplicate key.\n");
-                break;
-            case (EXECUTE_TABLE_FULL):
-                printf("Error: Table full.\n");
-                break;
-        }
+        run_input(input_buffer, table, &named, &summary, batch);
     }
 }
\ No newline at end of file
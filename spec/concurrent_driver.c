@@ -0,0 +1,190 @@
+// concurrent mode can only be turned on through DbOptions, so the spec builds this driver around db.c to exercise it.
+// usage: concurrent_driver <file> <statements>
+//
+// the table starts out with every even id up to 2 * STABLE_ROWS, and those rows are never deleted. one writer thread inserts,
+// deletes and updates odd ids in between them, so the leaves holding the even ids keep splitting and merging, while reader
+// threads scan the whole table and look up even ids. every scan has to see every even id exactly once, in order, and every
+// lookup has to find its row. once the writer is done, a scan, the row count at the root and the writer's own tally have
+// to agree
+#define main db_main
+#include "../db.c"
+#undef main
+
+#define STABLE_ROWS 5000
+#define SCAN_THREADS 2
+#define FIND_THREADS 2
+
+Table* table;
+bool writer_done = false;
+
+void fail(const char* message, u_int32_t a, u_int32_t b) {
+    fprintf(stderr, "FAIL: %s (%u, %u)\n", message, a, b);
+    exit(EXIT_FAILURE);
+}
+
+// rows are written with their id as the username, so a row read back under the wrong key shows
+void check_row(void* record, u_int32_t key) {
+    Row row;
+    deserialize_row(record, &row);
+    char username[16];
+    sprintf(username, "u%u", key);
+    if (row.id != key || strcmp(row.username, username) != 0) {
+        fail("row doesn't match its key", key, row.id);
+    }
+}
+
+void* scanner(void* argument) {
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+        Cursor* cursor = table_start(table);
+        u_int32_t previous = 0;
+        u_int32_t even_rows = 0;
+        while (!cursor->end_of_table) {
+            void* node = get_page(table->pager, cursor->page_num);
+            u_int32_t key = *leaf_node_key(node, cursor->cell_num);
+            if (key <= previous) {
+                fail("scan out of order", previous, key);
+            }
+            check_row(leaf_node_value(node, cursor->cell_num), key);
+            unpin_page(table->pager, cursor->page_num);
+            even_rows += key % 2 == 0;
+            previous = key;
+            cursor_advance(cursor);
+        }
+        close_cursor(cursor);
+        if (even_rows != STABLE_ROWS) {
+            fail("scan lost or repeated rows", even_rows, STABLE_ROWS);
+        }
+    }
+    return NULL;
+}
+
+void* finder(void* argument) {
+    unsigned seed = (unsigned long)argument;
+    while (!__atomic_load_n(&writer_done, __ATOMIC_ACQUIRE)) {
+        u_int32_t key = 2 * (1 + rand_r(&seed) % STABLE_ROWS);
+        Cursor* cursor = table_find(table, key);
+        void* node = get_page(table->pager, cursor->page_num);
+        if (cursor->cell_num >= *leaf_node_num_cells(node) || *leaf_node_key(node, cursor->cell_num) != key) {
+            fail("lookup missed a row", key, 0);
+        }
+        check_row(leaf_node_value(node, cursor->cell_num), key);
+        unpin_page(table->pager, cursor->page_num);
+        close_cursor(cursor);
+    }
+    return NULL;
+}
+
+void run(const char* sql) {
+    Statement statement;
+    if (prepare_sql(sql, &statement) != PREPARE_SUCCESS) {
+        fail("statement didn't prepare", 0, 0);
+    }
+    execute_statement(&statement, table);
+    free_statement(&statement);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("Usage: concurrent_driver <file> <statements>\n");
+        exit(EXIT_FAILURE);
+    }
+    u_int32_t num_statements = atoi(argv[2]);
+    char wal_filename[4096];
+    snprintf(wal_filename, sizeof(wal_filename), "%s-wal", argv[1]);
+    unlink(argv[1]);
+    unlink(wal_filename);
+
+    DbOptions options = { 0 };
+    options.num_frames = 64;
+    options.checkpoint_pages = DEFAULT_CHECKPOINT_PAGES;
+    options.checkpoint_seconds = DEFAULT_CHECKPOINT_SECONDS;
+    options.use_wal = true;
+    options.wal_group = 1000;
+    options.fill_factor = DEFAULT_FILL_FACTOR;
+    options.sort_memory_kb = DEFAULT_SORT_MEMORY_KB;
+    options.num_threads = 1;
+    options.concurrent = true;
+    options.use_io_uring = true;
+    options.page_size = DEFAULT_PAGE_SIZE;
+    table = db_open(argv[1], &options);
+
+    char sql[8192];
+    for (u_int32_t first = 1; first <= STABLE_ROWS; first += 50) {
+        int length = sprintf(sql, "insert values ");
+        for (u_int32_t i = first; i < first + 50 && i <= STABLE_ROWS; i++) {
+            length += sprintf(sql + length, "%s(%u, u%u, e%u)", i == first ? "" : ", ", 2 * i, 2 * i, 2 * i);
+        }
+        run(sql);
+    }
+
+    pthread_t threads[SCAN_THREADS + FIND_THREADS];
+    for (long i = 0; i < SCAN_THREADS + FIND_THREADS; i++) {
+        pthread_create(&threads[i], NULL, i < SCAN_THREADS ? scanner : finder, (void*)i);
+    }
+
+    // the writer keeps track of which odd ids are in, so it knows how many rows there should be at the end
+    u_int8_t* present = calloc(STABLE_ROWS + 1, 1);
+    u_int32_t odd_rows = 0;
+    srand(1);
+    for (u_int32_t n = 0; n < num_statements; n++) {
+        u_int32_t slot = rand() % STABLE_ROWS;
+        u_int32_t key = 2 * slot + 1;
+        int op = rand() % 10;
+        char email[256];
+        u_int32_t email_length = 1 + rand() % 200;
+        memset(email, 'e', email_length);
+        email[email_length] = '\0';
+        if (op < 5) {
+            // a run of neighbouring odd ids in one statement, with long emails so leaves fill and split
+            int length = sprintf(sql, "insert values ");
+            u_int32_t count = 0;
+            for (u_int32_t i = slot; i < slot + 20 && i < STABLE_ROWS; i++) {
+                if (!present[i]) {
+                    length += sprintf(sql + length, "%s(%u, u%u, %s%u)", count ? ", " : "", 2 * i + 1, 2 * i + 1, email, i);
+                    present[i] = 1;
+                    count++;
+                    odd_rows++;
+                }
+            }
+            if (count > 0) {
+                run(sql);
+            }
+        } else if (op < 9) {
+            // deleting a run of odd ids one by one empties leaves out, so they borrow and merge
+            for (u_int32_t i = slot; i < slot + 10 && i < STABLE_ROWS; i++) {
+                if (present[i]) {
+                    sprintf(sql, "delete where id = %u", 2 * i + 1);
+                    run(sql);
+                    present[i] = 0;
+                    odd_rows--;
+                }
+            }
+        } else {
+            // rows on both sides get rewritten with a different length
+            sprintf(sql, "update %u set email=%s", key + rand() % 2, email);
+            run(sql);
+        }
+    }
+    __atomic_store_n(&writer_done, true, __ATOMIC_RELEASE);
+    for (int i = 0; i < SCAN_THREADS + FIND_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    Cursor* cursor = table_start(table);
+    u_int32_t scanned = 0;
+    while (!cursor->end_of_table) {
+        scanned++;
+        cursor_advance(cursor);
+    }
+    close_cursor(cursor);
+    u_int32_t counted = table_num_rows(table);
+    if (scanned != STABLE_ROWS + odd_rows || counted != scanned) {
+        fail("row counts disagree", scanned, counted);
+    }
+    db_close(table);
+    unlink(argv[1]);
+    free(present);
+
+    printf("%u rows\n", scanned);
+    return 0;
+}
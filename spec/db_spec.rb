@@ -1,18 +1,26 @@
 describe 'database' do
-    def run_script(commands)
+    before do
+        `rm -rf mydb.db mydb.db-wal load.csv`
+    end
+
+    def run_script(commands, flags = "")
         raw_output = nil
-        IO.popen("./db mydb.db", "r+") do |pipe|
-            commands.each do |command|
-                begin
-                    pipe.puts command
-                rescue Errno::EPIPE
-                    break
+        IO.popen("./db #{flags} mydb.db", "r+") do |pipe|
+            # write from a separate thread so a long script can't fill the output pipe and deadlock
+            writer = Thread.new do
+                commands.each do |command|
+                    begin
+                        pipe.puts command
+                    rescue Errno::EPIPE
+                        break
+                    end
                 end
-            end
 
-            pipe.close_write
+                pipe.close_write
+            end
 
             raw_output = pipe.gets(nil)
+            writer.join
         end
         raw_output.split("\n")
     end
@@ -31,16 +39,22 @@ describe 'database' do
     #     ])
     # end
 
-    it 'prints error message when table is full' do
-        script = (1..1401).map do |i|
-            "insert #{i} user#{i} person#{i}@example.com"
+    it 'splits internal nodes once the root is full' do
+        # long emails, so leaves fill up after a dozen rows or so
+        email = "e" * 230
+        ids = (1..8000).to_a.shuffle(random: Random.new(1))
+        script = ids.map do |i|
+            "insert #{i} user#{i} #{email}#{i}@example.com"
         end
+        script << ".stats"
+        script << "select"
         script << ".exit"
-        result = run_script(script)
-        expect(result.last(2)).to match_array([
-            "db > Executed.",
-            "db > Need to implement updating parent after split",
-        ])
+        result = run_script(script, "--frames 16 --wal-group 1000")
+
+        expect(result[8000]).to eq("db > Tree depth: 3")
+        rows = result[8004..-3]
+        expect(rows.first).to eq("db > (1, user1, #{email}1@example.com)")
+        expect(rows.drop(1)).to eq((2..8000).map { |i| "(#{i}, user#{i}, #{email}#{i}@example.com)" })
     end
 
 
@@ -121,12 +135,12 @@ describe 'database' do
 
         expect(result).to match_array([
             "db > Constants:",
+            "PAGE_SIZE: 4096",
             "ROW_SIZE: 293",
             "COMMON_NODE_HEADER_SIZE: 6",
-            "LEAF_NODE_HEADER_SIZE: 14",
-            "LEAF_NODE_CELL_SIZE: 297",
-            "LEAF_NODE_SPACE_FOR_CELLS: 4082",
-            "LEAF_NODE_MAX_CELLS: 13",
+            "LEAF_NODE_HEADER_SIZE: 22",
+            "LEAF_NODE_SLOT_SIZE: 6",
+            "LEAF_NODE_SPACE_FOR_CELLS: 4072",
             "db > ",
         ])
     end
@@ -171,18 +185,20 @@ describe 'database' do
     # end
 
     it 'allows printing out the structure of a 3-leaf-node btree' do
-        script = (1..14).map do |i|
-            "insert #{i} user#{i} person#{i}@example.com"
+        # rows with the longest email take about 270 bytes, so the 15th doesn't fit into one leaf anymore. it comes after every
+        # other id, so the full leaf stays as it is and the 15th starts a new one
+        long_email = "a"*255
+        script = (1..15).map do |i|
+            "insert #{i} user#{i} #{long_email}"
         end
         script << ".btree"
-        script << "insert 15 user15 person15@example.com"
         script << ".exit"
         result = run_script(script)
 
-        expect(result[14...(result.length)]).to match_array([
+        expect(result[15...(result.length)]).to match_array([
             "db > Tree:",
             "- internal (size 1)",
-            "  - leaf (size 7)",
+            "  - leaf (size 14)",
             "    - 1",
             "    - 2",
             "    - 3",
@@ -190,8 +206,6 @@ describe 'database' do
             "    - 5",
             "    - 6",
             "    - 7",
-            "  - key 7",
-            "  - leaf (size 7)",
             "    - 8",
             "    - 9",
             "    - 10",
@@ -199,11 +213,28 @@ describe 'database' do
             "    - 12",
             "    - 13",
             "    - 14",
-            "db > Executed.",
+            "  - key 14",
+            "  - leaf (size 1)",
+            "    - 15",
             "db > ",
         ])
     end
 
+    it 'stores short rows compactly' do
+        script = (1..100).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script)
+
+        # with fixed 293 byte rows this took 15 pages, now it's the header and a single leaf
+        expect(result[100...102]).to eq([
+            "db > Tree depth: 1",
+            "Pages: 2",
+        ])
+    end
+
     it 'prints all rows in a multi-level tree' do
         script = []
         (1..15).each do |i|
@@ -233,4 +264,767 @@ describe 'database' do
             "db > ",
         ])
     end
+
+    it 'works with a small buffer pool' do
+        script = (1..14).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "select"
+        script << ".exit"
+        result = run_script(script, "--frames 16")
+
+        expect(result[14]).to eq("db > (1, user1, person1@example.com)")
+        expect(result.last(2)).to eq([
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'rejects a buffer pool that is too small' do
+        result = run_script([".exit"], "--frames 4")
+        expect(result).to eq([
+            "Buffer pool needs at least 16 frames.",
+        ])
+    end
+
+    it 'keeps the page size a file was created with' do
+        script = (1..1000).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << ".exit"
+        result = run_script(script, "--page-size 16")
+        # a quarter of the leaves the same rows take with 4 KB pages
+        expect(result[1000..1001]).to eq(["db > Tree depth: 2", "Pages: 5"])
+
+        # the header says 16 KB, whatever the flags say now
+        result = run_script([".constants", "select where id between 999 and 1000", ".exit"], "--page-size 4")
+        expect(result[1]).to eq("PAGE_SIZE: 16384")
+        expect(result[-4..-1]).to eq([
+            "db > (999, user999, person999@example.com)",
+            "(1000, user1000, person1000@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+
+        result = run_script([".exit"], "--page-size 12")
+        expect(result).to eq([
+            "Page size must be a power of two between 4 and 64 KB.",
+        ])
+    end
+
+    it 'checkpoints only the pages that changed' do
+        script = [
+            "insert 1 user1 person1@example.com",
+            ".checkpoint",
+            ".checkpoint",
+            "insert 2 user2 person2@example.com",
+            ".checkpoint",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Checkpoint wrote 1 dirty pages.",
+            "db > Checkpoint wrote 0 dirty pages.",
+            "db > Executed.",
+            "db > Checkpoint wrote 1 dirty pages.",
+            "db > ",
+        ])
+    end
+
+    it 'recovers committed inserts from the wal after a crash' do
+        # no .exit, so the process dies on end of input without checkpointing
+        run_script([
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+        ])
+        expect(File.size("mydb.db-wal")).to be > 0
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+        expect(File.exist?("mydb.db-wal")).to be false
+    end
+
+    it 'replays a leftover wal even when opened without one' do
+        run_script([
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+        ])
+        expect(File.size("mydb.db-wal")).to be > 0
+
+        result = run_script([
+            "select",
+            "delete where id = 1",
+            "insert 3 user3 person3@example.com",
+            ".exit",
+        ], "--no-wal")
+        expect(result.first(3)).to eq([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+        ])
+        expect(File.exist?("mydb.db-wal")).to be false
+
+        # the old log is gone, so its page images can't bring row 1 back over the no-wal session's changes
+        result = run_script(["select", ".exit"])
+        expect(result).to eq([
+            "db > (2, user2, person2@example.com)",
+            "(3, user3, person3@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps data written in mmap mode' do
+        run_script([
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+            ".exit",
+        ], "--mmap")
+        expect(File.size("mydb.db")).to eq(8192)
+
+        result = run_script([
+            "select",
+            ".exit",
+        ], "--mmap")
+        expect(result).to eq([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'bulk loads a sorted file' do
+        File.write("load.csv", (1..1000).map { |i| "#{i},user#{i},person#{i}@example.com\n" }.join)
+        result = run_script([
+            ".load load.csv",
+            ".stats",
+            "insert 1001 user1001 person1001@example.com",
+            ".exit",
+        ])
+        expect(result.first(3)).to eq([
+            "db > Loaded 1000 rows.",
+            "db > Tree depth: 2",
+            "Pages: 13",
+        ])
+
+        result = run_script(["select", ".exit"])
+        expect(result.first).to eq("db > (1, user1, person1@example.com)")
+        expect(result[1..-3]).to eq((2..1001).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" })
+    end
+
+    it 'packs rows inserted in id order as tightly as a bulk load' do
+        script = (1..1000).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".stats"
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+
+        # the same 13 pages .load uses for these rows, where even splits would leave every leaf half empty
+        expect(result[1000..1001]).to eq(["db > Tree depth: 2", "Pages: 13"])
+        rows = result[1004..-3]
+        expect(rows.first).to eq("db > (1, user1, person1@example.com)")
+        expect(rows.drop(1)).to eq((2..1000).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" })
+    end
+
+    it 'bulk loads an unsorted file through an external sort' do
+        ids = (1..500).to_a.shuffle(random: Random.new(1))
+        File.write("load.csv", ids.map { |i| "#{i},user#{i},person#{i}@example.com\n" }.join)
+        result = run_script([".load load.csv", "select", ".exit"], "--sort-memory 16")
+
+        expect(result[0]).to eq("db > Loaded 500 rows.")
+        expect(result[1]).to eq("db > (1, user1, person1@example.com)")
+        expect(result[2..-3]).to eq((2..500).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" })
+    end
+
+    it 'rejects a bulk load with duplicate keys' do
+        File.write("load.csv", "3,a,a@example.com\n1,b,b@example.com\n3,c,c@example.com\n")
+        result = run_script([".load load.csv", "select", ".exit"], "--sort-memory 1")
+        expect(result).to eq([
+            "db > Error: Duplicate key.",
+            "db > Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'selects by id, by id range and with a limit' do
+        script = (1..30).map do |i|
+            "insert #{i * 2} user#{i * 2} person#{i * 2}@example.com"
+        end
+        script << "select where id = 14"
+        script << "select where id = 15"
+        script << "select where id between 23 and 29"
+        script << "select where id between 50 and 1000 limit 2"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[30..-1]).to eq([
+            "db > (14, user14, person14@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > (24, user24, person24@example.com)",
+            "(26, user26, person26@example.com)",
+            "(28, user28, person28@example.com)",
+            "Executed.",
+            "db > (50, user50, person50@example.com)",
+            "(52, user52, person52@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'writes pages past the first 4 GB of the file' do
+        run_script([".exit"])
+        # grow the file sparsely, so new pages get allocated beyond the 32 bit offset range
+        File.truncate("mydb.db", 4 * 1024 * 1024 * 1024 + 8192)
+        long_email = "a"*255
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} #{long_email}"
+        end
+        script << ".exit"
+        run_script(script)
+        expect(File.size("mydb.db")).to be > 4 * 1024 * 1024 * 1024 + 8192
+
+        result = run_script(["select", ".exit"])
+        expect(result.first).to eq("db > (1, user1, #{long_email})")
+        expect(result[1..-3]).to eq((2..30).map { |i| "(#{i}, user#{i}, #{long_email})" })
+    end
+
+    it 'opens files written before the header page existed' do
+        # the oldest format: root leaf on page 0, every cell a key followed by a fixed 293 byte row
+        cells = [1, 2].map do |i|
+            [i, i, "user#{i}", "person#{i}@example.com"].pack("L<L<a33a256")
+        end
+        page = [1, 1, 0, 2, 0].pack("CCL<L<L<") + cells.join
+        File.binwrite("mydb.db", page.ljust(4096, "\0"))
+
+        result = run_script(["insert 3 user3 person3@example.com", "select", ".exit"])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "(3, user3, person3@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+        expect(File.binread("mydb.db", 8)).to eq("mini-db\0")
+    end
+
+    it 'deletes by id and by id range' do
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << "delete where id = 3"
+        script << "delete where id = 3"
+        script << "delete where id between 5 and 18"
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[20..-1]).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "(4, user4, person4@example.com)",
+            "(19, user19, person19@example.com)",
+            "(20, user20, person20@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'merges leaves and reuses freed pages after deletes' do
+        long_email = "a"*255
+        script = (1..300).map do |i|
+            "insert #{i} user#{i} #{long_email}"
+        end
+        script << ".stats"
+        script << "delete where id between 1 and 290"
+        script << ".stats"
+        script += (301..590).map do |i|
+            "insert #{i} user#{i} #{long_email}"
+        end
+        script << ".stats"
+        script << "select where id between 289 and 292"
+        script << ".exit"
+        result = run_script(script)
+
+        pages = result[301]
+        expect(result[300]).to eq("db > Tree depth: 2")
+        # ten rows fit on the root again, every other page went on the freelist
+        expect(result[305..306]).to eq(["db > Tree depth: 1", pages])
+        expect(result[308]).to eq("Free pages: #{pages[/\d+/].to_i - 2}")
+        # the same number of rows again fits without growing the file
+        expect(result[599..600]).to eq(["db > Tree depth: 2", pages])
+        expect(result[602]).to eq("Free pages: 0")
+        expect(result[603..-1]).to eq([
+            "db > (291, user291, #{long_email})",
+            "(292, user292, #{long_email})",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'updates a row in place' do
+        long_email = "a"*255
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} #{long_email}"
+        end
+        script << ".checkpoint"
+        script << "update 7 set username=seven"
+        script << "update 8 set username=eight, email=eight@example.com"
+        script << ".checkpoint"
+        script << "update 31 set email=nobody@example.com"
+        script << "update 7 set password=secret"
+        script << "select where id between 7 and 8"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[31..-1]).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            # both rows live on the same leaf, and nothing else changed
+            "db > Checkpoint wrote 1 dirty pages.",
+            "db > Error: Key not found.",
+            "db > Syntax error. Could not parse statement.",
+            "db > (7, seven, #{long_email})",
+            "(8, eight, eight@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'runs a script in batch mode' do
+        File.write("script.sql", [
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+            "insert 1 user1 person1@example.com",
+            "update 3 set username=nobody",
+            "bogus",
+            "select",
+        ].join("\n"))
+        result = `./db --script script.sql mydb.db`.split("\n")
+        File.delete("script.sql")
+
+        expect(result).to eq([
+            "Error: Duplicate key.",
+            "Error: Key not found.",
+            "Unrecognized keyword at start of 'bogus'.",
+            "(1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Batch: 3 executed, 1 duplicate key, 1 key not found, 0 table full, 1 rejected.",
+        ])
+        # the end of the script closed the database cleanly
+        expect(File.exist?("mydb.db-wal")).to be false
+    end
+
+    it 'inserts several rows in one statement' do
+        # out of order, and enough of them to split leaves along the way
+        rows = (1..300).to_a.reverse.map { |i| "(#{i}, user#{i}, #{"e" * 100}#{i})" }
+        script = [
+            "insert values (3, c, c@example.com), (1, a, a@example.com),(2,b,b@example.com)",
+            "insert values (2, z, z@example.com), (4, d, d@example.com)",
+            "insert values (5, e, e@example.com) (6, f, f@example.com)",
+            "select",
+            "insert values #{rows[0..295].join(", ")}",
+            "select where id between 299 and 300",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result).to eq([
+            "db > Executed.",
+            # the duplicate is skipped, the other row still goes in
+            "db > Error: Duplicate key.",
+            "db > Syntax error. Could not parse statement.",
+            "db > (1, a, a@example.com)",
+            "(2, b, b@example.com)",
+            "(3, c, c@example.com)",
+            "(4, d, d@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > (299, user299, #{"e" * 100}299)",
+            "(300, user300, #{"e" * 100}300)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'runs prepared statements with new parameters' do
+        script = [
+            "prepare add as insert ? ? ?",
+            "execute add 1 user1 person1@example.com",
+            "execute add 2 user2 person2@example.com",
+            "execute add 3 user3",
+            "insert ? user4 person4@example.com",
+            "prepare rename as update ? set username=?",
+            "execute rename 2 renamed",
+            "prepare find as select where id between ? and ?",
+            "execute find 2 5",
+            "deallocate find",
+            "execute find 1 1",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result).to eq([
+            "db > Prepared.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > Syntax error. Could not parse statement.",
+            "db > Prepared.",
+            "db > Executed.",
+            "db > Prepared.",
+            "db > (2, renamed, person2@example.com)",
+            "Executed.",
+            "db > Deallocated.",
+            "db > Error: No such prepared statement.",
+            "db > ",
+        ])
+    end
+
+    it 'exports to csv and binary files that load back' do
+        script = (1..50).to_a.shuffle.map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << ".export export.csv"
+        script << ".export export.bin binary"
+        script << ".export export.bin json"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[-4..-1]).to eq([
+            "db > Exported 50 rows.",
+            "db > Exported 50 rows.",
+            "db > Usage: .export <file> [csv|binary]",
+            "db > ",
+        ])
+        expect(File.read("export.csv")).to eq((1..50).map { |i| "#{i},user#{i},person#{i}@example.com\n" }.join)
+
+        `rm -f mydb.db`
+        result = run_script([
+            ".load export.bin",
+            "select where id between 49 and 60",
+            ".exit",
+        ])
+        File.delete("export.csv", "export.bin")
+
+        expect(result).to eq([
+            "db > Loaded 50 rows.",
+            "db > (49, user49, person49@example.com)",
+            "(50, user50, person50@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'quotes csv fields with commas and quotes so they load back unchanged' do
+        result = run_script([
+            "insert 1 a,b c,d",
+            "insert 2 say\"hi\" x\"y,z",
+            ".export export.csv",
+            ".export export.bin binary junk",
+            ".exit",
+        ])
+        expect(result[-3..-1]).to eq([
+            "db > Exported 2 rows.",
+            "db > Usage: .export <file> [csv|binary]",
+            "db > ",
+        ])
+        expect(File.read("export.csv")).to eq("1,\"a,b\",\"c,d\"\n2,\"say\"\"hi\"\"\",\"x\"\"y,z\"\n")
+
+        `rm -f mydb.db`
+        result = run_script([".load export.csv", "select", ".exit"])
+        File.delete("export.csv")
+        expect(result).to eq([
+            "db > Loaded 2 rows.",
+            "db > (1, a,b, c,d)",
+            "(2, say\"hi\", x\"y,z)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'computes aggregates across threads' do
+        File.write("load.csv", (1..5000).map { |i| "#{i},user#{i},#{"e" * 100}#{i}@example.com\n" }.join)
+        script = [
+            "select count(*), min(id), max(id)",
+            ".load load.csv",
+            "select count(*), min(id), max(id), sum(id)",
+            "select count(*), sum(id) where id between 1000 and 3999",
+            "select min(id), max(id) where id between 6000 and 7000",
+            "select count(*) limit 1",
+            ".exit",
+        ]
+        expected = [
+            "db > (0, NULL, NULL)",
+            "Executed.",
+            "db > Loaded 5000 rows.",
+            "db > (5000, 1, 5000, #{(1..5000).sum})",
+            "Executed.",
+            "db > (3000, #{(1000..3999).sum})",
+            "Executed.",
+            "db > (NULL, NULL)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ]
+
+        # the answer can't depend on how the work was split up
+        ["--threads 1", "--threads 4", "--threads 7 --frames 16"].each do |flags|
+            `rm -f mydb.db`
+            expect(run_script(script, flags)).to eq(expected)
+        end
+    end
+
+    it 'counts and skips rows by position' do
+        File.write("load.csv", (1..5000).map { |i| "#{i},user#{i},#{"e" * 100}#{i}@example.com\n" }.join)
+        result = run_script([
+            ".load load.csv",
+            "delete where id between 100 and 1099",
+            "select count(*), min(id), max(id)",
+            "select count(*) where id between 50 and 1200",
+            "select limit 2 offset 3000",
+            "select where id between 1000 and 2000 limit 1 offset 99",
+            "select offset 4000",
+            "select count(*) offset 1",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Loaded 5000 rows.",
+            "db > Executed.",
+            "db > (4000, 1, 5000)",
+            "Executed.",
+            "db > (151)",
+            "Executed.",
+            "db > (4001, user4001, #{"e" * 100}4001@example.com)",
+            "(4002, user4002, #{"e" * 100}4002@example.com)",
+            "Executed.",
+            "db > (1199, user1199, #{"e" * 100}1199@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+    end
+
+    it 'rebuilds internal nodes without row counts' do
+        # a headerless file with the old internal node layout as root: no counts, cells of just child and key
+        leaf = lambda do |ids, next_leaf|
+            cells = ids.map { |i| [i, i, "user#{i}", "person#{i}@example.com"].pack("L<L<a33a256") }
+            ([1, 0, 0, ids.length, next_leaf].pack("CCL<L<L<") + cells.join).ljust(4096, "\0")
+        end
+        root = [0, 1, 0, 1, 2, 1, 1].pack("CCL<L<L<L<L<").ljust(4096, "\0")
+        File.binwrite("mydb.db", root + leaf.call([1], 2) + leaf.call([2, 3], 0))
+
+        result = run_script([
+            "insert 4 user4 person4@example.com",
+            "select count(*), min(id), max(id)",
+            "select limit 2 offset 1",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > (4, 1, 4)",
+            "Executed.",
+            "db > (2, user2, person2@example.com)",
+            "(3, user3, person3@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'looks rows up through indexes on username and email' do
+        script = (1..300).map do |i|
+            "insert #{i} user#{i % 10} person#{i}@example.com"
+        end
+        script += [
+            "select where email = person42@example.com",
+            "create index on email",
+            "create index on username",
+            "select where email = person42@example.com",
+            "select where email like person29% limit 3",
+            "update 42 set email=someone@example.com",
+            "select where email = person42@example.com",
+            "select where email = someone@example.com",
+            "delete where id between 3 and 290",
+            "select where username = user3",
+            "select count(*) where email = x",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result[300..-1]).to eq([
+            "db > (42, user2, person42@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (42, user2, person42@example.com)",
+            "Executed.",
+            "db > (290, user0, person290@example.com)",
+            "(291, user1, person291@example.com)",
+            "(292, user2, person292@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (42, user2, someone@example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > (293, user3, person293@example.com)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+
+        # the indexes are still there after reopening
+        result = run_script(["select where username = user1", ".exit"])
+        expect(result).to eq(["db > (1, user1, person1@example.com)", "(291, user1, person291@example.com)", "Executed.", "db > "])
+    end
+
+    it 'filters rows by suffix and substring without an index' do
+        script = (1..200).map do |i|
+            "insert #{i} user#{i % 7} person#{i}@#{i % 2 == 0 ? 'corp' : 'home'}.example.com"
+        end
+        script += [
+            "select where email like %@corp.example.com limit 3",
+            "select where email like %on19% offset 2",
+            "select where username like %r6 limit 2 offset 1",
+            "select where email like %nomatch%",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result[200..-1]).to eq([
+            "db > (2, user2, person2@corp.example.com)",
+            "(4, user4, person4@corp.example.com)",
+            "(6, user6, person6@corp.example.com)",
+            "Executed.",
+            "db > (191, user2, person191@home.example.com)",
+            "(192, user3, person192@corp.example.com)",
+            "(193, user4, person193@home.example.com)",
+            "(194, user5, person194@corp.example.com)",
+            "(195, user6, person195@home.example.com)",
+            "(196, user0, person196@corp.example.com)",
+            "(197, user1, person197@home.example.com)",
+            "(198, user2, person198@corp.example.com)",
+            "(199, user3, person199@home.example.com)",
+            "Executed.",
+            "db > (13, user6, person13@home.example.com)",
+            "(20, user6, person20@corp.example.com)",
+            "Executed.",
+            "db > Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'answers pipelined statements over a unix socket' do
+        require 'socket'
+        socket_path = "#{Dir.pwd}/mydb.sock"
+        output, server_output = IO.pipe
+        pid = spawn("./db", "--listen", socket_path, "mydb.db", out: server_output)
+        server_output.close
+        # stop the server even when an expectation fails, so rspec doesn't hang waiting on it
+        begin
+            expect(output.gets).to eq("Listening on #{socket_path}\n")
+
+            client = UNIXSocket.new(socket_path)
+            # everything goes out before any reply is read
+            client.write([
+                "insert 1 user1 person1@example.com",
+                "insert 2 user2 person2@example.com",
+                "insert 1 user1 person1@example.com",
+                "prepare by_id as select where id = ?",
+                "execute by_id 2",
+                "select",
+                ".exit",
+            ].join("\n") + "\n")
+            replies = 6.times.map { client.read(client.gets.to_i) }
+            expect(client.read).to eq("")
+            client.close
+        ensure
+            Process.kill("TERM", pid)
+            Process.wait(pid)
+            output.close
+        end
+        expect(File.exist?(socket_path)).to be false
+
+        expect(replies).to eq([
+            "Executed.\n",
+            "Executed.\n",
+            "Error: Duplicate key.\n",
+            "Prepared.\n",
+            "(2, user2, person2@example.com)\nExecuted.\n",
+            "(1, user1, person1@example.com)\n(2, user2, person2@example.com)\nExecuted.\n",
+        ])
+        expect(run_script(["select", ".exit"])).to eq([
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'gives the same answers with and without io_uring' do
+        File.write("load.csv", (1..3000).map { |i| "#{i},user#{i},#{"e" * 100}#{i}@example.com\n" }.join)
+        script = [
+            "delete where id between 100 and 1999",
+            "insert 150 user150 again150@example.com",
+            "select where email like %99@example.com",
+            "select count(*), sum(id)",
+            ".exit",
+        ]
+        results = ["", "--no-io-uring"].map do |flags|
+            `rm -f mydb.db mydb.db-wal`
+            run_script([".load load.csv", ".exit"], flags)
+            # a fresh process with a small pool, so the scans read their leaves back from the file
+            run_script(script, "--frames 128 --checkpoint-pages 16 #{flags}")
+        end
+
+        expect(results[0]).to eq(results[1])
+        expect(results[0]).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > (99, user99, #{"e" * 100}99@example.com)",
+            "(2099, user2099, #{"e" * 100}2099@example.com)",
+            "(2199, user2199, #{"e" * 100}2199@example.com)",
+            "(2299, user2299, #{"e" * 100}2299@example.com)",
+            "(2399, user2399, #{"e" * 100}2399@example.com)",
+            "(2499, user2499, #{"e" * 100}2499@example.com)",
+            "(2599, user2599, #{"e" * 100}2599@example.com)",
+            "(2699, user2699, #{"e" * 100}2699@example.com)",
+            "(2799, user2799, #{"e" * 100}2799@example.com)",
+            "(2899, user2899, #{"e" * 100}2899@example.com)",
+            "(2999, user2999, #{"e" * 100}2999@example.com)",
+            "Executed.",
+            "db > (1101, #{(1..99).sum + 150 + (2000..3000).sum})",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps scans and lookups consistent while a writer runs in concurrent mode' do
+        # concurrent mode is only reachable through DbOptions, so the threads run in a small driver built around db.c. it
+        # fails with a message if a reader sees a row go missing or out of order, or if the row counts disagree at the end
+        build = `gcc -O2 -pthread -o concurrent_driver spec/concurrent_driver.c 2>&1`
+        expect($?.success?).to be(true), build
+        output = `./concurrent_driver concurrent.db 5000 2>&1`
+        succeeded = $?.success?
+        File.delete("concurrent_driver")
+
+        expect(succeeded).to be(true), output
+        expect(output).to match(/\A\d+ rows\n\z/)
+    end
 end
\ No newline at end of file